@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "aho_corasick.h"
+
+namespace ure {
+
+using namespace std;
+
+// Marks slots of the double array that aren't used by any state.
+const int32_t free_slot = -1;
+// check value for the root, which isn't any state's child.
+const int32_t root_check = -2;
+
+AhoCorasick::AhoCorasick(const vector<string>& literals) {
+  // Build an ordinary trie first, then lay it out as a double array.
+  vector<map<unsigned char, size_t>> children(1);
+  vector<vector<size_t>> ids(1);
+  for (size_t id = 0; id < literals.size(); id++) {
+    size_t node = 0;
+    for (char ch : literals[id]) {
+      unsigned char c = ch;
+      auto it = children[node].find(c);
+      if (it == children[node].end()) {
+        children[node][c] = children.size();
+        node = children.size();
+        children.emplace_back();
+        ids.emplace_back();
+      } else {
+        node = it->second;
+      }
+    }
+    ids[node].push_back(id);
+    lengths.push_back(literals[id].size());
+  }
+
+  // Place states in breadth first order. For each state, find the lowest base at which
+  // all of its children land on free slots.
+  vector<int32_t> slot_of(children.size());
+  vector<size_t> order = {0};
+  slot_of[0] = 0;
+  base.assign(1, 0);
+  check.assign(1, root_check);
+  size_t first_free = 1;
+  for (size_t i = 0; i < order.size(); i++) {
+    size_t node = order[i];
+    int32_t slot = slot_of[node];
+    if (children[node].empty()) continue;
+
+    unsigned char first_label = children[node].begin()->first;
+    size_t b = max<size_t>(1, first_free > first_label ? first_free - first_label : 1);
+    while (true) {
+      bool fits = true;
+      for (const auto& edge : children[node]) {
+        size_t t = b + edge.first;
+        if (t < check.size() && check[t] != free_slot) {
+          fits = false;
+          break;
+        }
+      }
+      if (fits) break;
+      b++;
+    }
+
+    base[slot] = b;
+    for (const auto& edge : children[node]) {
+      size_t t = b + edge.first;
+      if (t >= check.size()) {
+        base.resize(t + 1, 0);
+        check.resize(t + 1, free_slot);
+      }
+      check[t] = slot;
+      slot_of[edge.second] = t;
+      order.push_back(edge.second);
+    }
+    while (first_free < check.size() && check[first_free] != free_slot) first_free++;
+  }
+
+  size_t num_slots = check.size();
+  output_begin.assign(num_slots + 1, 0);
+  vector<vector<size_t>> slot_ids(num_slots);
+  for (size_t node = 0; node < children.size(); node++) {
+    slot_ids[slot_of[node]] = ids[node];
+  }
+  for (size_t slot = 0; slot < num_slots; slot++) {
+    output_begin[slot] = output_ids.size();
+    output_ids.insert(output_ids.end(), slot_ids[slot].begin(), slot_ids[slot].end());
+  }
+  output_begin[num_slots] = output_ids.size();
+
+  // Failure links, again in breadth first order so that a state's failure link is always
+  // computed before those of its children.
+  fail.assign(num_slots, 0);
+  output_link.assign(num_slots, -1);
+  for (size_t node : order) {
+    int32_t slot = slot_of[node];
+    for (const auto& edge : children[node]) {
+      int32_t t = slot_of[edge.second];
+      int32_t f = 0;
+      if (slot != 0) {
+        f = fail[slot];
+        while (f != 0 && child(f, edge.first) == -1) f = fail[f];
+        int32_t next = child(f, edge.first);
+        f = next == -1 ? 0 : next;
+      }
+      fail[t] = f;
+      bool f_has_output = output_begin[f] != output_begin[f + 1];
+      output_link[t] = f_has_output ? f : output_link[f];
+    }
+  }
+}
+
+int32_t AhoCorasick::next_state(int32_t state, unsigned char c) const {
+  while (true) {
+    int32_t t = child(state, c);
+    if (t != -1) return t;
+    if (state == 0) return 0;
+    state = fail[state];
+  }
+}
+
+vector<SetMatch> AhoCorasick::find_all(const char* data, size_t size) const {
+  vector<SetMatch> matches;
+  int32_t state = 0;
+  for (size_t idx = 0; idx <= size; idx++) {
+    if (idx > 0) state = next_state(state, data[idx - 1]);
+    // Report the literals ending here, from longest to shortest.
+    int32_t out = output_begin[state] != output_begin[state + 1] ? state : output_link[state];
+    for (; out != -1; out = output_link[out]) {
+      for (size_t i = output_begin[out]; i < output_begin[out + 1]; i++) {
+        size_t id = output_ids[i];
+        matches.push_back({id, idx - lengths[id], idx});
+      }
+    }
+  }
+  return matches;
+}
+
+vector<size_t> AhoCorasick::partial_match(const char* data, size_t size) const {
+  vector<bool> matched(lengths.size(), false);
+  size_t num_matched = 0;
+  int32_t state = 0;
+  for (size_t idx = 0; idx <= size && num_matched < lengths.size(); idx++) {
+    if (idx > 0) state = next_state(state, data[idx - 1]);
+    int32_t out = output_begin[state] != output_begin[state + 1] ? state : output_link[state];
+    for (; out != -1; out = output_link[out]) {
+      for (size_t i = output_begin[out]; i < output_begin[out + 1]; i++) {
+        if (!matched[output_ids[i]]) {
+          matched[output_ids[i]] = true;
+          num_matched++;
+        }
+      }
+    }
+  }
+
+  vector<size_t> ids;
+  for (size_t id = 0; id < matched.size(); id++) {
+    if (matched[id]) ids.push_back(id);
+  }
+  return ids;
+}
+
+vector<size_t> AhoCorasick::full_match(const char* data, size_t size) const {
+  // Only follow the trie itself: a literal equal to the text ends at the state reached by
+  // reading all of it from the root.
+  int32_t state = 0;
+  for (size_t idx = 0; idx < size; idx++) {
+    state = child(state, data[idx]);
+    if (state == -1) return {};
+  }
+  return vector<size_t>(output_ids.begin() + output_begin[state],
+                        output_ids.begin() + output_begin[state + 1]);
+}
+
+}  // namespace ure
@@ -0,0 +1,76 @@
+#ifndef AHO_CORASICK_H
+#define AHO_CORASICK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ure {
+
+// An occurrence of pattern id at text[start, end).
+struct SetMatch {
+  std::size_t id;
+  std::size_t start;
+  std::size_t end;
+
+  bool operator==(const SetMatch& other) const {
+    return id == other.id && start == other.start && end == other.end;
+  }
+};
+
+// Aho-Corasick automaton for finding every occurrence of a set of literal strings in one
+// pass over the text.
+//
+// The trie is stored as a double array (Aoe, "An Efficient Digital Search Algorithm by
+// Using a Double-Array Structure", 1989): the child of state s on byte c is t = base[s] + c
+// if check[t] == s. Children of every state are packed into a shared pair of int arrays,
+// so a transition is two array reads rather than a search through a per-state map, and the
+// whole automaton is a handful of flat arrays.
+class AhoCorasick {
+ public:
+  AhoCorasick() : AhoCorasick(std::vector<std::string>()) {}
+  AhoCorasick(const std::vector<std::string>& literals);
+
+  // Every occurrence of every literal in text, ordered by end offset, and from longest to
+  // shortest among occurrences ending at the same offset.
+  std::vector<SetMatch> find_all(const char* data, std::size_t size) const;
+
+  // Ids of the literals which occur anywhere in text, in increasing order.
+  std::vector<std::size_t> partial_match(const char* data, std::size_t size) const;
+
+  // Ids of the literals equal to text, in increasing order.
+  std::vector<std::size_t> full_match(const char* data, std::size_t size) const;
+
+  std::vector<SetMatch> find_all(const std::string& text) const {
+    return find_all(text.data(), text.size());
+  }
+  std::vector<std::size_t> partial_match(const std::string& text) const {
+    return partial_match(text.data(), text.size());
+  }
+  std::vector<std::size_t> full_match(const std::string& text) const {
+    return full_match(text.data(), text.size());
+  }
+
+ private:
+  std::vector<std::int32_t> base;
+  std::vector<std::int32_t> check;
+  std::vector<std::int32_t> fail;
+  // Nearest state along the failure links which ends a literal, or -1.
+  std::vector<std::int32_t> output_link;
+  // Ids of the literals ending at state s are output_ids[output_begin[s], output_begin[s+1]).
+  std::vector<std::uint32_t> output_begin;
+  std::vector<std::size_t> output_ids;
+  std::vector<std::size_t> lengths;
+
+  std::int32_t child(std::int32_t state, unsigned char c) const {
+    std::size_t t = base[state] + c;
+    return t < check.size() && check[t] == state ? static_cast<std::int32_t>(t) : -1;
+  }
+
+  std::int32_t next_state(std::int32_t state, unsigned char c) const;
+};
+
+}  // namespace ure
+
+#endif  // AHO_CORASICK_H
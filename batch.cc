@@ -0,0 +1,28 @@
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+
+namespace ure {
+
+using namespace std;
+
+void for_each_range(size_t n, size_t num_threads,
+                    const function<void(size_t, size_t)>& f) {
+  num_threads = max<size_t>(1, min(num_threads, n));
+  size_t per_thread = n / num_threads;
+  auto range_begin = [&](size_t i) { return i == num_threads ? n : i * per_thread; };
+  vector<thread> threads;
+  for (size_t i = 1; i < num_threads; i++) {
+    threads.emplace_back(f, range_begin(i), range_begin(i + 1));
+  }
+  f(0, range_begin(1));
+  for (thread& t : threads) {
+    t.join();
+  }
+}
+
+}  // namespace ure
@@ -0,0 +1,30 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace ure {
+
+// A column of strings laid out as in Apache Arrow's string arrays: string i is
+// data[offsets[i], offsets[i + 1]), so offsets has size + 1 entries. The batch only points
+// into memory owned by the caller, so matching it never builds a std::string per row.
+struct StringBatch {
+  const char* data;
+  const std::int32_t* offsets;
+  std::size_t size;
+
+  const char* row_data(std::size_t i) const { return data + offsets[i]; }
+  std::size_t row_size(std::size_t i) const { return offsets[i + 1] - offsets[i]; }
+};
+
+// Splits [0, n) into num_threads contiguous ranges and calls f(begin, end) for each, the
+// first on the calling thread and the rest on threads of their own, returning once they're
+// all done. With num_threads <= 1 it's just f(0, n).
+void for_each_range(std::size_t n, std::size_t num_threads,
+                    const std::function<void(std::size_t, std::size_t)>& f);
+
+}  // namespace ure
+
+#endif  // BATCH_H
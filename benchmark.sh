@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Runs ure_benchmark and writes the results as JSON to $1 (default benchmark.json). Any
+# further arguments are passed to the benchmark, e.g. --benchmark_filter=UreNfa.
+out=$(realpath "${1:-benchmark.json}")
+shift
+bazel run -c opt --cxxopt=-std=c++14 :ure_benchmark -- \
+  --benchmark_out="$out" --benchmark_out_format=json "$@"
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "byte_set.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define URE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace ure {
+
+using namespace std;
+
+size_t find_first_in_scalar(const ByteSet& set, const char* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (set.contains(data[i])) return i;
+  }
+  return size;
+}
+
+#ifdef URE_X86_SIMD
+
+// The vector versions test membership with two table lookups (pshufb) per block of bytes.
+// A byte b is split into its low nibble lo and high nibble hi. Row lo of the bitmap,
+// restricted to the bytes with that low nibble, is a 16 bit mask over hi; its low 8 bits
+// go in one 16 byte table and its high 8 bits in another. Looking up both tables by lo,
+// picking one by whether hi >= 8, and testing bit hi % 8 gives exact membership for all
+// 256 bytes.
+struct NibbleTables {
+  alignas(16) uint8_t low_half[16];   // bit h set if (h << 4 | lo) is in the set, h < 8
+  alignas(16) uint8_t high_half[16];  // bit h set if ((h + 8) << 4 | lo) is in the set
+};
+
+NibbleTables nibble_tables(const ByteSet& set) {
+  NibbleTables tables = {};
+  for (int b = 0; b < 256; b++) {
+    if (!set.contains(static_cast<char>(b))) continue;
+    int lo = b & 0xf, hi = b >> 4;
+    if (hi < 8) {
+      tables.low_half[lo] |= 1 << hi;
+    } else {
+      tables.high_half[lo] |= 1 << (hi - 8);
+    }
+  }
+  return tables;
+}
+
+alignas(16) const uint8_t nibble_bits[16] = {
+  1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128,
+};
+
+__attribute__((target("ssse3")))
+size_t find_first_in_ssse3(const ByteSet& set, const char* data, size_t size) {
+  NibbleTables tables = nibble_tables(set);
+  const __m128i low_half = _mm_load_si128(reinterpret_cast<const __m128i*>(tables.low_half));
+  const __m128i high_half = _mm_load_si128(reinterpret_cast<const __m128i*>(tables.high_half));
+  const __m128i bits = _mm_load_si128(reinterpret_cast<const __m128i*>(nibble_bits));
+  const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+  const __m128i seven = _mm_set1_epi8(7);
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i lo = _mm_and_si128(v, nibble_mask);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble_mask);
+    __m128i use_high = _mm_cmpgt_epi8(hi, seven);
+    __m128i row = _mm_or_si128(_mm_andnot_si128(use_high, _mm_shuffle_epi8(low_half, lo)),
+                               _mm_and_si128(use_high, _mm_shuffle_epi8(high_half, lo)));
+    __m128i miss = _mm_cmpeq_epi8(_mm_and_si128(row, _mm_shuffle_epi8(bits, hi)), zero);
+    unsigned hits = ~_mm_movemask_epi8(miss) & 0xffff;
+    if (hits != 0) return i + __builtin_ctz(hits);
+  }
+  return i + find_first_in_scalar(set, data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+size_t find_first_in_avx2(const ByteSet& set, const char* data, size_t size) {
+  NibbleTables tables = nibble_tables(set);
+  // vpshufb looks up each 128 bit lane separately, so the tables are repeated per lane.
+  const __m256i low_half = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(tables.low_half)));
+  const __m256i high_half = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(tables.high_half)));
+  const __m256i bits = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(nibble_bits)));
+  const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+  const __m256i seven = _mm256_set1_epi8(7);
+  const __m256i zero = _mm256_setzero_si256();
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i lo = _mm256_and_si256(v, nibble_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble_mask);
+    __m256i use_high = _mm256_cmpgt_epi8(hi, seven);
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(low_half, lo),
+                                     _mm256_shuffle_epi8(high_half, lo), use_high);
+    __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(row, _mm256_shuffle_epi8(bits, hi)),
+                                     zero);
+    uint32_t hits = ~static_cast<uint32_t>(_mm256_movemask_epi8(miss));
+    if (hits != 0) return i + __builtin_ctz(hits);
+  }
+  return i + find_first_in_ssse3(set, data + i, size - i);
+}
+
+#endif  // URE_X86_SIMD
+
+size_t find_first_in(const ByteSet& set, const char* data, size_t size) {
+  // Building the nibble tables costs about as much as scanning a few blocks, so check a
+  // short prefix with the scalar loop first. Dense sets usually stop there.
+  size_t prefix = min<size_t>(size, 32);
+  size_t i = find_first_in_scalar(set, data, prefix);
+  if (i < prefix) return i;
+#ifdef URE_X86_SIMD
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+  if (has_avx2) return prefix + find_first_in_avx2(set, data + prefix, size - prefix);
+  if (has_ssse3) return prefix + find_first_in_ssse3(set, data + prefix, size - prefix);
+#endif
+  return prefix + find_first_in_scalar(set, data + prefix, size - prefix);
+}
+
+}  // namespace ure
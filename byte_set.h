@@ -0,0 +1,50 @@
+#ifndef BYTE_SET_H
+#define BYTE_SET_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ure {
+
+// Set of bytes stored as a 256-bit bitmap, so membership is a single bit test. Character
+// classes and built-in classes are converted to ByteSets when a program is built (see
+// instruction.h).
+struct ByteSet {
+  std::uint64_t bits[4] = {0, 0, 0, 0};
+
+  bool contains(char c) const {
+    unsigned char b = c;
+    return (bits[b >> 6] >> (b & 63)) & 1;
+  }
+
+  void insert(char c) {
+    unsigned char b = c;
+    bits[b >> 6] |= std::uint64_t{1} << (b & 63);
+  }
+
+  ByteSet& operator|=(const ByteSet& other) {
+    for (int i = 0; i < 4; i++) {
+      bits[i] |= other.bits[i];
+    }
+    return *this;
+  }
+
+  // Number of bytes in the set.
+  std::size_t count() const {
+    return __builtin_popcountll(bits[0]) + __builtin_popcountll(bits[1])
+           + __builtin_popcountll(bits[2]) + __builtin_popcountll(bits[3]);
+  }
+
+  bool operator==(const ByteSet& other) const {
+    return bits[0] == other.bits[0] && bits[1] == other.bits[1]
+           && bits[2] == other.bits[2] && bits[3] == other.bits[3];
+  }
+};
+
+// Returns the index of the first byte of data[0, size) which is in set, or size if there
+// isn't one. Tests 16 or 32 bytes at a time with SSSE3 or AVX2 when the CPU supports them.
+std::size_t find_first_in(const ByteSet& set, const char* data, std::size_t size);
+
+}  // namespace ure
+
+#endif  // BYTE_SET_H
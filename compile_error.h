@@ -0,0 +1,17 @@
+#ifndef COMPILE_ERROR_H
+#define COMPILE_ERROR_H
+
+#include <string>
+
+namespace ure {
+
+// A pattern parsed successfully, but couldn't be compiled into the form a particular
+// engine needs (e.g. its DFA would have too many states). See msg for details.
+struct CompileError {
+  std::string pattern;
+  std::string msg;
+};
+
+}  // namespace ure
+
+#endif  // COMPILE_ERROR_H
@@ -1,4 +1,5 @@
-#include <cctype>
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <string>
 
@@ -18,6 +19,14 @@ bool CharacterClass::match(char c) const {
   return negated;
 }
 
+ByteSet CharacterClass::byte_set() const {
+  ByteSet set;
+  for (int c = 0; c < 256; c++) {
+    if (match(static_cast<char>(c))) set.insert(static_cast<char>(c));
+  }
+  return set;
+}
+
 bool CharacterClass::operator==(const CharacterClass& other) const {
   return negated == other.negated && characters == other.characters && ranges == other.ranges;
 }
@@ -39,65 +48,8 @@ string CharacterClass::str() const {
   return s;
 }
 
-Instruction::Instruction(const Instruction& other) : type(other.type) {
-  switch (type) {
-    case IType::Literal:  // fallthrough
-    case IType::Wildcard:
-      c = other.c;
-      break;
-    case IType::Jump:  // fallthrough
-    case IType::Split:
-      offset = other.offset;
-      break;
-    case IType::Class:
-      new (&cclass) unique_ptr<const CharacterClass>(
-        make_unique<CharacterClass>(*other.cclass)
-      );
-      break;
-    case IType::Match:  // fallthrough
-    default:
-      break;
-  }
-}
-
-Instruction& Instruction::operator=(const Instruction& other) {
-  if (type == IType::Class) {
-    cclass.~unique_ptr<const CharacterClass>();
-  }
-  type = other.type;
-  switch (type) {
-    case IType::Literal:  // fallthrough
-    case IType::Wildcard:
-      c = other.c;
-      break;
-    case IType::Jump:  // fallthrough
-    case IType::Split:
-      offset = other.offset;
-      break;
-    case IType::Class:
-      cclass = make_unique<CharacterClass>(*other.cclass);
-      break;
-    case IType::Match:  // fallthrough
-    default:
-      break;
-  }
-
-  return *this;
-}
-
-Instruction::Instruction(unique_ptr<CharacterClass> character_class) {
-  new (&cclass) unique_ptr<const CharacterClass>(move(character_class));
-  type = IType::Class;
-}
-
-Instruction::~Instruction() {
-  if (type == IType::Class) {
-    cclass.~unique_ptr<const CharacterClass>();
-  }
-}
-
 Instruction Instruction::Literal(char c) {
-  Instruction inst;
+  Instruction inst{};
   inst.type = IType::Literal;
   inst.c = c;
   return inst;
@@ -105,37 +57,51 @@ Instruction Instruction::Literal(char c) {
 
 Instruction Instruction::Wildcard(char c) {
   assert(supported_built_in_classes.count(c) == 1 || c == '.' || c == '*');
-  Instruction inst;
+  Instruction inst{};
   inst.type = IType::Wildcard;
   inst.c = c;
   return inst;
 }
 
-Instruction Instruction::Class(unique_ptr<CharacterClass> character_class) {
-  return Instruction(move(character_class));
-}
-
-Instruction Instruction::Class(const CharacterClass& character_class) {
-  return Instruction(make_unique<CharacterClass>(character_class));
+Instruction Instruction::Class(uint32_t index) {
+  Instruction inst{};
+  inst.type = IType::Class;
+  inst.cclass = index;
+  return inst;
 }
 
 Instruction Instruction::Jump(std::ptrdiff_t offset) {
-  Instruction inst;
+  Instruction inst{};
   inst.type = IType::Jump;
   inst.offset = offset;
   return inst;
 }
 
 Instruction Instruction::Split(std::ptrdiff_t offset) {
-  Instruction inst;
+  Instruction inst{};
   inst.type = IType::Split;
   inst.offset = offset;
   return inst;
 }
 
-Instruction Instruction::Match() {
-  Instruction inst;
+Instruction Instruction::Match(size_t id) {
+  Instruction inst{};
   inst.type = IType::Match;
+  inst.id = id;
+  return inst;
+}
+
+Instruction Instruction::Save(size_t slot) {
+  Instruction inst{};
+  inst.type = IType::Save;
+  inst.slot = slot;
+  return inst;
+}
+
+Instruction Instruction::String(uint32_t index) {
+  Instruction inst{};
+  inst.type = IType::String;
+  inst.string_id = index;
   return inst;
 }
 
@@ -147,6 +113,8 @@ string type_to_str(IType t) {
     case IType::Split: return "Split";
     case IType::Match: return "Match";
     case IType::Class: return "Class";
+    case IType::Save: return "Save";
+    case IType::String: return "String";
     default: return "Unknown instruction type";
   }
 }
@@ -158,8 +126,10 @@ string Instruction::str() const {
     case IType::Wildcard: return s + " " + c;
     case IType::Jump: return s + " " + to_string(offset);
     case IType::Split: return s + " " + to_string(offset);
-    case IType::Match: return s;
-    case IType::Class: return s + " " + cclass->str();
+    case IType::Match: return id == 0 ? s : s + " " + to_string(id);
+    case IType::Class: return s + " #" + to_string(cclass);
+    case IType::Save: return s + " " + to_string(slot);
+    case IType::String: return s + " #" + to_string(string_id);
     default: return "Unknown instruction type";
   }
 }
@@ -168,9 +138,15 @@ ostream& operator<<(ostream& os, const Instruction& inst) {
   return os << inst.str();
 }
 
-ostream& operator<<(ostream& os, const vector<Instruction>& program) {
+ostream& operator<<(ostream& os, const Program& program) {
   for (size_t i = 0; i < program.size(); i++) {
-    os << i << " " << program[i] << endl;
+    os << i << " " << program[i];
+    if (program[i].type == IType::Class) {
+      os << " " << program.cclass(program[i]).str();
+    } else if (program[i].type == IType::String) {
+      os << " \"" << program.string_of(program[i]) << "\"";
+    }
+    os << endl;
   }
   return os;
 }
@@ -182,34 +158,135 @@ bool Instruction::operator==(const Instruction& other) const {
     case IType::Wildcard: return true;
     case IType::Jump: return offset == other.offset;
     case IType::Split: return offset == other.offset;
-    case IType::Match: return true;
-    case IType::Class: return *cclass == *other.cclass;
+    case IType::Match: return id == other.id;
+    case IType::Class: return cclass == other.cclass;
+    case IType::Save: return slot == other.slot;
+    case IType::String: return string_id == other.string_id;
     default:
       cerr << "Unknown type" << endl;
       return false;
   }
 }
 
+vector<ByteSet> build_built_in_classes() {
+  ByteSet digit, space, word, newline;
+  for (char c = '0'; c <= '9'; c++) digit.insert(c);
+  for (char c : {' ', '\t', '\n', '\v', '\f', '\r'}) space.insert(c);
+  for (char c = 'a'; c <= 'z'; c++) word.insert(c);
+  for (char c = 'A'; c <= 'Z'; c++) word.insert(c);
+  word |= digit;
+  word.insert('_');
+  newline.insert('\n');
+  newline.insert('\r');
+
+  auto complement = [](const ByteSet& set) {
+    ByteSet result;
+    for (int i = 0; i < 4; i++) {
+      result.bits[i] = ~set.bits[i];
+    }
+    return result;
+  };
+
+  vector<ByteSet> tables(256);
+  tables[static_cast<unsigned char>('*')] = complement(ByteSet());
+  tables[static_cast<unsigned char>('.')] = complement(newline);
+  tables[static_cast<unsigned char>('d')] = digit;
+  tables[static_cast<unsigned char>('D')] = complement(digit);
+  tables[static_cast<unsigned char>('s')] = space;
+  tables[static_cast<unsigned char>('S')] = complement(space);
+  tables[static_cast<unsigned char>('w')] = word;
+  tables[static_cast<unsigned char>('W')] = complement(word);
+  return tables;
+}
+
+const ByteSet& built_in_class(char c) {
+  static const vector<ByteSet> tables = build_built_in_classes();
+  return tables[static_cast<unsigned char>(c)];
+}
+
 bool Instruction::match_wildcard(char input) const {
   assert(type == IType::Wildcard);
-  switch (c) {
-    // Not usable for user-provided regular expressions: only used in match_all defined below.
-    case '*': return true;
-    case '.': return input != '\n' && input != '\r';
-    case 'd': return isdigit(input);
-    case 'D': return !isdigit(input);
-    case 's': return isspace(input);
-    case 'S': return !isspace(input);
-    case 'w': return isalnum(input) || input == '_';
-    case 'W': return !isalnum(input) && input != '_';
-    default:
-      cerr << "Unknown wildcard " << c << endl;
-      return false;
-  }
+  return built_in_class(c).contains(input);
 }
 
 const vector<Instruction> Instruction::match_all{
   Split(3), Wildcard('*'), Jump(-2)
 };
 
+Program::Program(vector<Instruction> code, vector<CharacterClass> classes)
+  : code(move(code)), classes(move(classes)) {
+  for (const CharacterClass& cclass : this->classes) {
+    class_sets.push_back(cclass.byte_set());
+  }
+}
+
+void Program::resize(size_t size) {
+  code.resize(size);
+  size_t used_classes = 0, used_strings = 0;
+  for (const Instruction& inst : code) {
+    if (inst.type == IType::Class) {
+      used_classes = max<size_t>(used_classes, inst.cclass + 1);
+    } else if (inst.type == IType::String) {
+      used_strings = max<size_t>(used_strings, inst.string_id + 1);
+    }
+  }
+  classes.resize(used_classes);
+  class_sets.resize(used_classes);
+  strings.resize(used_strings);
+}
+
+void Program::clear() {
+  code.clear();
+  classes.clear();
+  class_sets.clear();
+  strings.clear();
+}
+
+Instruction Program::add_class(CharacterClass cclass) {
+  class_sets.push_back(cclass.byte_set());
+  classes.push_back(move(cclass));
+  return Instruction::Class(classes.size() - 1);
+}
+
+Instruction Program::add_string(string s) {
+  strings.push_back(move(s));
+  return Instruction::String(strings.size() - 1);
+}
+
+void Program::append(const Program& other) {
+  uint32_t class_offset = classes.size();
+  uint32_t string_offset = strings.size();
+  for (Instruction inst : other.code) {
+    if (inst.type == IType::Class) {
+      inst.cclass += class_offset;
+    } else if (inst.type == IType::String) {
+      inst.string_id += string_offset;
+    }
+    code.push_back(inst);
+  }
+  classes.insert(classes.end(), other.classes.begin(), other.classes.end());
+  class_sets.insert(class_sets.end(), other.class_sets.begin(), other.class_sets.end());
+  strings.insert(strings.end(), other.strings.begin(), other.strings.end());
+}
+
+Program Program::unanchored() const {
+  Program program(Instruction::match_all, {});
+  program.append(*this);
+  return program;
+}
+
+bool Program::operator==(const Program& other) const {
+  if (code.size() != other.code.size()) return false;
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    if (code[pc].type == IType::Class && other.code[pc].type == IType::Class) {
+      if (!(cclass(code[pc]) == other.cclass(other.code[pc]))) return false;
+    } else if (code[pc].type == IType::String && other.code[pc].type == IType::String) {
+      if (string_of(code[pc]) != other.string_of(other.code[pc])) return false;
+    } else if (!(code[pc] == other.code[pc])) {
+      return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace ure
\ No newline at end of file
@@ -3,33 +3,46 @@
 
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <initializer_list>
 #include <iostream>
-#include <memory>
 #include <set>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "byte_set.h"
+
 namespace ure {
 
-enum class IType {
+enum class IType : std::uint8_t {
   Literal,
   Wildcard,
   Class,
   Jump,
   Split,
   Match,
+  Save,
+  String,
 };
 
 const std::set<char> supported_built_in_classes = { 'd', 'D', 's', 'S', 'w', 'W' };
 
+// Bytes matched by a Wildcard instruction: a built-in class, '.' or '*' (see match_all).
+// The tables are built once and use ASCII definitions, so they don't depend on the locale.
+const ByteSet& built_in_class(char c);
+
 class CharacterClass {
   public:
-   CharacterClass() {};
+   CharacterClass() : negated(false) {}
    CharacterClass(bool negated, std::vector<char> characters,
                   std::vector<std::pair<char, char>> ranges)
      : negated(negated), characters(characters), ranges(ranges) {}
 
    bool match(char c) const;
+   // The bytes matched by the class, as a bitmap.
+   ByteSet byte_set() const;
 
    bool operator==(const CharacterClass& other) const;
    std::string str() const;
@@ -40,45 +53,70 @@ class CharacterClass {
 };
 
 // Bytecode for compiled regular expressions. Each regular expression compiles to a
-// vector of Instructions (see parser.h). For example:
+// Program, a vector of Instructions (see parser.h). For example:
 //  "ab*" -> { Literal('a'), Split(3), Literal('b'), Jump(-2), Match() }
 //
 // Based on Russ Cox's article "Regular Expression Matching: the Virtual Machine Approach":
 // https://swtch.com/~rsc/regexp/regexp2.html. I've made some modifications, like using offsets
 // in the instruction array instead of pointers and simplifying the bytecode for the Split
 // Instruction.
+//
+// Instructions are plain 8 byte values, so programs can be copied with memcpy and pack
+// densely in cache. Character classes are too big to store inline, so they live in a table
+// in the Program, and Class instructions hold an index into it. String instructions (see
+// optimizer.h) work the same way.
 struct Instruction {
   IType type;
+  // Literal, Wildcard.
+  char c;
 
   union {
-    char c;
-    std::ptrdiff_t offset;
-    std::unique_ptr<const CharacterClass> cclass;
+    // Jump, Split.
+    std::int32_t offset;
+    // Match.
+    std::uint32_t id;
+    // Class: index in the program's class table.
+    std::uint32_t cclass;
+    // Save.
+    std::uint32_t slot;
+    // String: index in the program's string table.
+    std::uint32_t string_id;
   };
 
-  Instruction() {}
-  Instruction(const Instruction& other);
-  Instruction& operator=(const Instruction& other);
-  ~Instruction();
-
   // Consume the character c.
   static Instruction Literal(char c);
 
   // Consume a single character matching the wildcard or built-in character class.
   static Instruction Wildcard(char c);
 
-  // Consume a single character matching the provided character class.
-  static Instruction Class(std::unique_ptr<CharacterClass> character_class);
-  static Instruction Class(const CharacterClass& character_class);
+  // Consume a single character matching the character class at index in the program's
+  // class table (see Program::add_class).
+  static Instruction Class(std::uint32_t index);
 
   // Jump forward/backward in bytecode program by offset instructions.
   static Instruction Jump(std::ptrdiff_t offset);
 
-  // Either jump to the offset, or continue on to the next instruction.
+  // Either jump to the offset, or continue on to the next instruction. Where the choice
+  // matters (when reporting submatches), the next instruction is preferred for forward
+  // splits (the first alternative of |, and entering ? and *) and the jump for backward
+  // ones (repeating +), so quantifiers are greedy.
   static Instruction Split(std::ptrdiff_t offset);
 
-  // Regular expression matched!
-  static Instruction Match();
+  // Regular expression matched! When several patterns are compiled into one program (see
+  // ure_set.h), id identifies which one.
+  static Instruction Match(std::size_t id = 0);
+
+  // Record the current position in the text in capture slot number slot, without
+  // consuming anything. Group n's start and end go in slots 2n and 2n + 1. Only emitted
+  // when the parser is asked for captures (see parser.h); engines which don't report
+  // captures treat it like a Jump to the next instruction.
+  static Instruction Save(std::size_t slot);
+
+  // Consume the bytes of the string at index in the program's string table (see
+  // Program::add_string). Never produced by the parser, only by optimize() when asked to
+  // fuse runs of Literals (see optimizer.h), since only engines that can consume several
+  // bytes in one step (UreRecursive) support it.
+  static Instruction String(std::uint32_t index);
 
   bool match_wildcard(char c) const;
 
@@ -87,15 +125,83 @@ struct Instruction {
 
   // Compiled instructions to match any string. Used for partial_match implementation.
   static const std::vector<Instruction> match_all;
+};
+
+static_assert(std::is_trivially_copyable<Instruction>::value,
+              "Instructions must be copyable with memcpy");
+static_assert(sizeof(Instruction) <= 8, "Instructions should fit in 8 bytes");
+
+// A compiled regular expression: the instructions, plus the table of character classes
+// used by its Class instructions. Has the parts of the std::vector interface the parser
+// and engines use, so it can mostly be treated as a vector of Instructions.
+class Program {
+ public:
+  Program() {}
+  Program(std::initializer_list<Instruction> code) : code(code) {}
+  Program(std::vector<Instruction> code, std::vector<CharacterClass> classes);
+
+  std::size_t size() const { return code.size(); }
+  bool empty() const { return code.empty(); }
+  Instruction& operator[](std::size_t pc) { return code[pc]; }
+  const Instruction& operator[](std::size_t pc) const { return code[pc]; }
+  Instruction& back() { return code.back(); }
+  const Instruction& back() const { return code.back(); }
+  std::vector<Instruction>::iterator begin() { return code.begin(); }
+  std::vector<Instruction>::iterator end() { return code.end(); }
+  std::vector<Instruction>::const_iterator begin() const { return code.begin(); }
+  std::vector<Instruction>::const_iterator end() const { return code.end(); }
+  const Instruction* data() const { return code.data(); }
+
+  void push_back(Instruction inst) { code.push_back(inst); }
+  void insert(std::vector<Instruction>::iterator pos, Instruction inst) { code.insert(pos, inst); }
+  // Also drops classes and strings which are no longer referenced by any instruction.
+  void resize(std::size_t size);
+  void clear();
+
+  // Adds cclass to the class table and returns a Class instruction referencing it.
+  Instruction add_class(CharacterClass cclass);
+  const CharacterClass& cclass(const Instruction& inst) const {
+    assert(inst.type == IType::Class);
+    return classes[inst.cclass];
+  }
+  // The bytes matched by a Wildcard or Class instruction. Classes are converted to bitmaps
+  // when they're added, so engines can test a byte against any class with one lookup.
+  const ByteSet& byte_set(const Instruction& inst) const {
+    assert(inst.type == IType::Wildcard || inst.type == IType::Class);
+    return inst.type == IType::Class ? class_sets[inst.cclass] : built_in_class(inst.c);
+  }
+  const std::vector<CharacterClass>& class_table() const { return classes; }
+
+  // Adds s to the string table and returns a String instruction referencing it.
+  Instruction add_string(std::string s);
+  const std::string& string_of(const Instruction& inst) const {
+    assert(inst.type == IType::String);
+    return strings[inst.string_id];
+  }
+
+  // Appends the instructions of other, adding its classes and strings to this program's
+  // tables.
+  void append(const Program& other);
+
+  // Returns a program which matches any text containing a match of this one, by prefixing
+  // it with Instruction::match_all.
+  Program unanchored() const;
+
+  // Equal if the instructions are equal, and Class and String instructions refer to equal
+  // classes and strings.
+  bool operator==(const Program& other) const;
+  bool operator!=(const Program& other) const { return !(*this == other); }
 
  private:
-  Instruction(std::unique_ptr<CharacterClass> character_class);
+  std::vector<Instruction> code;
+  std::vector<CharacterClass> classes;
+  // class_sets[i] is classes[i].byte_set().
+  std::vector<ByteSet> class_sets;
+  std::vector<std::string> strings;
 };
 
 std::ostream& operator<<(std::ostream& os, const Instruction& inst);
-std::ostream& operator<<(std::ostream& os, const std::vector<Instruction>& program);
-
-
+std::ostream& operator<<(std::ostream& os, const Program& program);
 
 }  // namespace ure
 
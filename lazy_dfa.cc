@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+#include "lazy_dfa.h"
+
+namespace ure {
+
+using namespace std;
+
+constexpr int LazyDfa::unknown_state;
+
+// Rough per-state bookkeeping cost (map node, State struct) beyond the transition row and
+// the pc lists, used when checking the memory bound.
+const size_t state_overhead = 96;
+
+LazyDfa::LazyDfa(const Program& program, size_t max_memory, bool sticky_match)
+  : program(program), max_memory(max_memory), sticky_match(sticky_match),
+    start(unknown_state), used_memory(0), flushes(0), visited(program.size(), false) {}
+
+// Expands pcs in place to the set of consuming and Match instructions reachable from it
+// by following Jump and Split instructions. The result is sorted so it can be used as a
+// key for state_ids.
+void LazyDfa::closure(vector<size_t>& pcs) {
+  stack = pcs;
+  pcs.clear();
+  seen.clear();
+  while (!stack.empty()) {
+    size_t pc = stack.back();
+    stack.pop_back();
+    if (pc >= program.size()) {
+      cerr << "Invalid program counter " << pc
+           << ", program.size() is " << program.size() << endl;
+      continue;
+    }
+    if (visited[pc]) continue;
+    visited[pc] = true;
+    seen.push_back(pc);
+
+    const Instruction& inst = program[pc];
+    switch (inst.type) {
+      case IType::Jump:
+        stack.push_back(pc + inst.offset);
+        break;
+      case IType::Save:
+        stack.push_back(pc + 1);
+        break;
+      case IType::Split:
+        stack.push_back(pc + inst.offset);
+        stack.push_back(pc + 1);
+        break;
+      case IType::Literal:  // fallthrough
+      case IType::Wildcard:  // fallthrough
+      case IType::Class:  // fallthrough
+      case IType::Match:
+        pcs.push_back(pc);
+        break;
+      default:
+        cerr << "Unknown instruction type" << endl;
+        break;
+    }
+  }
+  for (size_t pc : seen) {
+    visited[pc] = false;
+  }
+  sort(pcs.begin(), pcs.end());
+}
+
+void LazyDfa::flush() {
+  states.clear();
+  state_ids.clear();
+  transitions.clear();
+  start = unknown_state;
+  used_memory = 0;
+  flushes++;
+}
+
+int LazyDfa::add_state(vector<size_t> pcs) {
+  auto it = state_ids.find(pcs);
+  if (it != state_ids.end()) return it->second;
+
+  // The pc list is stored twice, once in the State and once as the map key.
+  size_t cost = 256 * sizeof(int) + 2 * pcs.size() * sizeof(size_t) + state_overhead;
+  if (used_memory + cost > max_memory && !states.empty()) {
+    flush();
+  }
+  used_memory += cost;
+
+  bool match = false;
+  for (size_t pc : pcs) {
+    if (program[pc].type == IType::Match) {
+      match = true;
+      break;
+    }
+  }
+
+  int id = states.size();
+  state_ids.emplace(pcs, id);
+  states.push_back({move(pcs), match});
+  transitions.resize(states.size() * 256, unknown_state);
+  return id;
+}
+
+int LazyDfa::start_state() {
+  if (start == unknown_state) {
+    vector<size_t> pcs;
+    if (!program.empty()) {
+      pcs.push_back(0);
+      closure(pcs);
+    }
+    start = add_state(move(pcs));
+  }
+  return start;
+}
+
+int LazyDfa::compute_next_state(int state, char c) {
+  vector<size_t> next;
+  for (size_t pc : states[state].pcs) {
+    const Instruction& inst = program[pc];
+    switch (inst.type) {
+      case IType::Literal:
+        if (inst.c == c) next.push_back(pc + 1);
+        break;
+      case IType::Wildcard:  // fallthrough
+      case IType::Class:
+        if (program.byte_set(inst).contains(c)) next.push_back(pc + 1);
+        break;
+      case IType::Match:
+        if (sticky_match) next.push_back(pc);
+        break;
+      default:
+        break;
+    }
+  }
+  closure(next);
+
+  size_t flushes_before = flushes;
+  int next_id = add_state(move(next));
+  // If the cache was flushed, the source state no longer exists, so there's no row to
+  // record the transition in.
+  if (flushes == flushes_before) {
+    transitions[state * 256 + static_cast<unsigned char>(c)] = next_id;
+  }
+  return next_id;
+}
+
+}  // namespace ure
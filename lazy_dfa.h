@@ -0,0 +1,93 @@
+#ifndef LAZY_DFA_H
+#define LAZY_DFA_H
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+#include "instruction.h"
+
+namespace ure {
+
+// Deterministic automaton built on demand from a bytecode program (see instruction.h).
+//
+// Each DFA state corresponds to the set of program counters an NFA simulation (see
+// ure_nfa.cc) would have live at some point in the text, after following all Jump and
+// Split instructions. Only consuming instructions (Literal, Wildcard, Class) and Match
+// are kept in the set. States and transitions are created the first time they're needed
+// and cached, so the cost of the NFA simulation is paid once per (state, byte) pair
+// instead of once per byte of text.
+//
+// Based on Russ Cox's article "Regular Expression Matching in the Wild":
+// https://swtch.com/~rsc/regexp/regexp3.html
+//
+// The cache is bounded by max_memory (in bytes, approximate). When adding a state would
+// exceed the bound, the whole cache is flushed and rebuilt from the state being added.
+// Flushing invalidates every previously returned state id.
+class LazyDfa {
+ public:
+  // Returned by next_state() for transitions that haven't been computed yet. Never
+  // returned to callers.
+  static constexpr int unknown_state = -1;
+
+  // If sticky_match is set, Match instructions stay in the state once reached, so the
+  // final state records every Match instruction reached anywhere in the text (used by
+  // UreSet, see ure_set.h).
+  LazyDfa(const Program& program, std::size_t max_memory,
+          bool sticky_match = false);
+  LazyDfa() : LazyDfa({}, 0) {}
+
+  int start_state();
+
+  // Returns the state reached from state after consuming c. May flush the cache, in which
+  // case all state ids other than the returned one become invalid.
+  int next_state(int state, char c) {
+    int next = transitions[state * 256 + static_cast<unsigned char>(c)];
+    if (next != unknown_state) return next;
+    return compute_next_state(state, c);
+  }
+
+  bool is_match(int state) const { return states[state].match; }
+
+  // No Match instruction can be reached from this state, whatever the rest of the text.
+  bool is_dead(int state) const { return states[state].pcs.empty(); }
+
+  // Program counters of the consuming and Match instructions making up the state.
+  const std::vector<std::size_t>& state_pcs(int state) const { return states[state].pcs; }
+
+  std::size_t num_states() const { return states.size(); }
+  std::size_t num_flushes() const { return flushes; }
+  std::size_t memory_used() const { return used_memory; }
+
+ private:
+  struct State {
+    std::vector<std::size_t> pcs;
+    bool match;
+  };
+
+  Program program;
+  std::size_t max_memory;
+  bool sticky_match;
+
+  std::vector<State> states;
+  std::map<std::vector<std::size_t>, int> state_ids;
+  // states.size() * 256 entries, indexed by state * 256 + (unsigned char) c.
+  std::vector<int> transitions;
+  int start;
+  std::size_t used_memory;
+  std::size_t flushes;
+
+  // Scratch space for closure(), kept between calls to avoid reallocating.
+  std::vector<std::size_t> stack;
+  std::vector<std::size_t> seen;
+  std::vector<bool> visited;
+
+  int compute_next_state(int state, char c);
+  int add_state(std::vector<std::size_t> pcs);
+  void flush();
+  void closure(std::vector<std::size_t>& pcs);
+};
+
+}  // namespace ure
+
+#endif  // LAZY_DFA_H
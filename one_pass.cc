@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "one_pass.h"
+
+namespace ure {
+
+using namespace std;
+
+constexpr uint32_t OnePassDfa::dead_node;
+
+bool build_one_pass(const Program& program, OnePassDfa& dfa) {
+  OnePassDfa result;
+  for (const Instruction& inst : program) {
+    if (inst.type == IType::Save) {
+      if (inst.slot >= max_one_pass_slots) return false;
+      result.num_slots = max<size_t>(result.num_slots, inst.slot + 1);
+    }
+  }
+
+  // Nodes are numbered in the order they're discovered, starting from pc 0.
+  vector<uint32_t> node_of(program.size() + 1, OnePassDfa::dead_node);
+  vector<size_t> node_pcs = {0};
+  node_of[0] = 0;
+
+  vector<bool> visited(program.size(), false);
+  vector<size_t> seen;
+  vector<pair<size_t, uint32_t>> stack;  // (pc, slots saved on the way)
+  for (size_t node = 0; node < node_pcs.size(); node++) {
+    if (node_pcs.size() > max_one_pass_nodes) return false;
+    result.transitions.resize((node + 1) * 256, {OnePassDfa::dead_node, 0});
+    result.accepting.push_back(false);
+    result.match_saves.push_back(0);
+    OnePassDfa::Transition* row = &result.transitions[node * 256];
+
+    // Follow every path from the node to a consuming or Match instruction. If two paths
+    // meet, there are two threads which would behave the same from then on, but may have
+    // saved different slots, so the program isn't one-pass.
+    for (size_t pc : seen) {
+      visited[pc] = false;
+    }
+    seen.clear();
+    stack.push_back({node_pcs[node], 0});
+    while (!stack.empty()) {
+      size_t pc = stack.back().first;
+      uint32_t saves = stack.back().second;
+      stack.pop_back();
+      if (pc >= program.size()) return false;
+      if (visited[pc]) return false;
+      visited[pc] = true;
+      seen.push_back(pc);
+
+      const Instruction& inst = program[pc];
+      switch (inst.type) {
+        case IType::Jump:
+          stack.push_back({pc + inst.offset, saves});
+          break;
+        case IType::Split:
+          stack.push_back({pc + 1, saves});
+          stack.push_back({pc + inst.offset, saves});
+          break;
+        case IType::Save:
+          stack.push_back({pc + 1, saves | uint32_t{1} << inst.slot});
+          break;
+        case IType::Match:
+          result.accepting[node] = true;
+          result.match_saves[node] = saves;
+          break;
+        case IType::Literal:  // fallthrough
+        case IType::Wildcard:  // fallthrough
+        case IType::Class: {
+          if (node_of[pc + 1] == OnePassDfa::dead_node) {
+            node_of[pc + 1] = node_pcs.size();
+            node_pcs.push_back(pc + 1);
+          }
+          OnePassDfa::Transition transition = {node_of[pc + 1], saves};
+          for (int c = 0; c < 256; c++) {
+            char ch = static_cast<char>(c);
+            bool consumes = inst.type == IType::Literal ? inst.c == ch
+                                                        : program.byte_set(inst).contains(ch);
+            if (!consumes) continue;
+            // Two threads could continue on this byte.
+            if (row[c].next != OnePassDfa::dead_node) return false;
+            row[c] = transition;
+          }
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+  }
+
+  dfa = move(result);
+  return true;
+}
+
+// Sets the slots in mask to idx.
+void save_slots(uint32_t mask, size_t idx, size_t* slots) {
+  while (mask != 0) {
+    slots[__builtin_ctz(mask)] = idx;
+    mask &= mask - 1;
+  }
+}
+
+bool one_pass_full_match(const OnePassDfa& dfa, const char* data, size_t size, size_t* slots) {
+  if (dfa.num_nodes() == 0) return false;
+  for (size_t slot = 0; slot < dfa.num_slots; slot++) {
+    slots[slot] = string::npos;
+  }
+  const OnePassDfa::Transition* transitions = dfa.transitions.data();
+  uint32_t node = 0;
+  for (size_t idx = 0; idx < size; idx++) {
+    const OnePassDfa::Transition& transition =
+        transitions[node * 256 + static_cast<unsigned char>(data[idx])];
+    if (transition.next == OnePassDfa::dead_node) return false;
+    save_slots(transition.saves, idx, slots);
+    node = transition.next;
+  }
+  if (!dfa.accepting[node]) return false;
+  save_slots(dfa.match_saves[node], size, slots);
+  return true;
+}
+
+}  // namespace ure
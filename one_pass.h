@@ -0,0 +1,65 @@
+#ifndef ONE_PASS_H
+#define ONE_PASS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "instruction.h"
+
+namespace ure {
+
+// Capture slots a one-pass DFA can track: group 0 and 15 parenthesized groups.
+const std::size_t max_one_pass_slots = 32;
+// Programs with more nodes than this aren't compiled to one-pass DFAs, to bound the size
+// of the table (2 KB per node).
+const std::size_t max_one_pass_nodes = 1024;
+
+// DFA which records capture positions (see Instruction::Save) as it goes, for programs
+// which are "one-pass": wherever a match is in progress, the next byte of text decides
+// which single thread continues. For example "(\w+)@(\w+)" is one-pass, since @ is never
+// in \w, but "(\w+)(\w+)" isn't, since after a word character there's no telling which
+// group the next one belongs to.
+//
+// Each node is a program counter where a thread can be between bytes: pc 0, or the
+// instruction after a consuming one. Since only one thread can continue on each byte,
+// the transition from a node on a byte is a single node, plus the slots to save along
+// the way. Matching is then a table walk, at DFA speed, rather than a simulation of all
+// possible threads.
+//
+// Based on RE2's onepass.cc, and Russ Cox's article "Regular Expression Matching in the
+// Wild": https://swtch.com/~rsc/regexp/regexp3.html
+struct OnePassDfa {
+  struct Transition {
+    // The node to move to, or dead_node if no thread can consume the byte.
+    std::uint32_t next;
+    // Bitmask of the slots to set to the current position before consuming the byte.
+    std::uint32_t saves;
+  };
+
+  static constexpr std::uint32_t dead_node = UINT32_MAX;
+
+  // num_nodes() * 256 entries, indexed by node * 256 + (unsigned char) c. Node 0 is the
+  // start node.
+  std::vector<Transition> transitions;
+  // Whether a Match instruction is reachable from each node without consuming anything,
+  // and the slots to set on the way there.
+  std::vector<bool> accepting;
+  std::vector<std::uint32_t> match_saves;
+  std::size_t num_slots = 0;
+
+  std::size_t num_nodes() const { return accepting.size(); }
+};
+
+// Builds a one-pass DFA for program (which may contain Save instructions). Returns false
+// without modifying dfa if program isn't one-pass, or uses too many slots or nodes.
+bool build_one_pass(const Program& program, OnePassDfa& dfa);
+
+// Returns whether dfa matches the whole of text. If it does, sets slots[0, dfa.num_slots)
+// to the saved positions, or std::string::npos for slots that were never saved.
+bool one_pass_full_match(const OnePassDfa& dfa, const char* data, std::size_t size,
+                         std::size_t* slots);
+
+}  // namespace ure
+
+#endif  // ONE_PASS_H
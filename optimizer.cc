@@ -0,0 +1,172 @@
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "optimizer.h"
+
+namespace ure {
+
+using namespace std;
+
+// The passes below work on a copy of the code, with the targets of Jumps and Splits as
+// absolute pcs (target[pc], unused for other instructions), which are easier to rewrite
+// than offsets. Offsets are only recomputed once the final layout is known.
+
+// Follows Jumps from pc to the first instruction that isn't one. Gives up after as many
+// steps as there are instructions, in case the Jumps form a loop. Otherwise every Jump on
+// the way is pointed straight at the end, so long chains are only followed once.
+size_t skip_jumps(const vector<Instruction>& code, vector<size_t>& target, size_t pc) {
+  size_t end = pc;
+  for (size_t steps = 0; steps < code.size(); steps++) {
+    if (end >= code.size() || code[end].type != IType::Jump) break;
+    end = target[end];
+  }
+  if (end < code.size() && code[end].type == IType::Jump) return end;
+  while (pc != end) {
+    size_t next = target[pc];
+    target[pc] = end;
+    pc = next;
+  }
+  return end;
+}
+
+// Threads Jumps and simplifies Splits, returning true if anything changed. Goes from the
+// last instruction to the first, since a simplified Split usually makes it possible to
+// simplify the ones before it (like the Splits of nested "|"s), which can then be done in
+// the same pass.
+bool thread_branches(vector<Instruction>& code, vector<size_t>& target) {
+  bool changed = false;
+  for (size_t pc = code.size(); pc-- > 0;) {
+    if (code[pc].type != IType::Jump && code[pc].type != IType::Split) continue;
+    size_t jump_to = skip_jumps(code, target, target[pc]);
+    // Engines prefer a Split's target if it's backwards, and the next instruction otherwise,
+    // so a Split can only go straight to the final target if that's on the same side.
+    bool keeps_priority = code[pc].type != IType::Split || (jump_to < pc) == (target[pc] < pc);
+    if (jump_to != target[pc] && keeps_priority) {
+      target[pc] = jump_to;
+      changed = true;
+    }
+    if (code[pc].type != IType::Split) continue;
+
+    // A branch which comes straight back to the Split is an empty loop: every engine drops
+    // a thread which reaches the same pc twice at the same position, so only the other
+    // branch can ever lead anywhere. And if both branches lead to the same place, it
+    // doesn't matter which one is taken.
+    size_t next = skip_jumps(code, target, pc + 1);
+    if (next == pc || next == jump_to) {
+      code[pc] = Instruction::Jump(0);
+      changed = true;
+    } else if (jump_to == pc) {
+      code[pc] = Instruction::Jump(0);
+      target[pc] = next;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Marks the instructions reachable from pc 0.
+vector<bool> reachable(const vector<Instruction>& code, const vector<size_t>& target) {
+  vector<bool> seen(code.size(), false);
+  vector<size_t> stack = {0};
+  while (!stack.empty()) {
+    size_t pc = stack.back();
+    stack.pop_back();
+    if (pc >= code.size() || seen[pc]) continue;
+    seen[pc] = true;
+    switch (code[pc].type) {
+      case IType::Jump:
+        stack.push_back(target[pc]);
+        break;
+      case IType::Split:
+        stack.push_back(pc + 1);
+        stack.push_back(target[pc]);
+        break;
+      case IType::Match:
+        break;
+      default:
+        stack.push_back(pc + 1);
+        break;
+    }
+  }
+  return seen;
+}
+
+Program optimize(const Program& program, bool strings) {
+  vector<Instruction> code(program.begin(), program.end());
+  vector<size_t> target(code.size(), 0);
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    if (code[pc].type == IType::Jump || code[pc].type == IType::Split) {
+      target[pc] = pc + code[pc].offset;
+    }
+  }
+  while (thread_branches(code, target)) {}
+
+  // Decide which instructions to keep, from the last to the first so that a Jump can be
+  // dropped if nothing is kept between it and its target.
+  vector<bool> keep = reachable(code, target);
+  size_t next_kept = code.size();
+  for (size_t pc = code.size(); pc-- > 0;) {
+    if (!keep[pc]) continue;
+    if (code[pc].type == IType::Jump && target[pc] == next_kept) {
+      keep[pc] = false;
+      continue;
+    }
+    next_kept = pc;
+  }
+
+  // A Literal can be fused with the one before it unless something else can get to it.
+  vector<bool> entry(code.size(), false);
+  if (!code.empty()) entry[0] = true;
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    if (keep[pc] && (code[pc].type == IType::Jump || code[pc].type == IType::Split) &&
+        target[pc] < code.size()) {
+      entry[target[pc]] = true;
+    }
+  }
+  // run_size[pc] is the number of Literals fused into a String at pc (0 for instructions
+  // inside a run, which are dropped, and 1 for everything else).
+  vector<size_t> run_size(code.size(), 1);
+  if (strings) {
+    for (size_t pc = 0; pc < code.size(); pc++) {
+      if (!keep[pc] || code[pc].type != IType::Literal) continue;
+      size_t end = pc + 1;
+      while (end < code.size() && keep[end] && code[end].type == IType::Literal &&
+             !entry[end]) {
+        run_size[end++] = 0;
+      }
+      run_size[pc] = end - pc;
+      pc = end - 1;
+    }
+  }
+
+  // Dropped instructions get the new pc of the next kept one, which is where Jumps to them
+  // should go.
+  vector<size_t> new_pc(code.size() + 1);
+  size_t size = 0;
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    new_pc[pc] = size;
+    if (keep[pc] && run_size[pc] > 0) size++;
+  }
+  new_pc[code.size()] = size;
+
+  Program optimized = program;
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    if (!keep[pc] || run_size[pc] == 0) continue;
+    Instruction inst = code[pc];
+    if (inst.type == IType::Jump || inst.type == IType::Split) {
+      inst.offset = static_cast<ptrdiff_t>(new_pc[target[pc]]) - new_pc[pc];
+    } else if (run_size[pc] > 1) {
+      string s;
+      for (size_t i = pc; i < pc + run_size[pc]; i++) {
+        s += code[i].c;
+      }
+      inst = optimized.add_string(s);
+    }
+    optimized[new_pc[pc]] = inst;
+  }
+  optimized.resize(size);
+  return optimized;
+}
+
+}  // namespace ure
@@ -0,0 +1,29 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "instruction.h"
+
+namespace ure {
+
+// Peephole optimizer for parsed programs. Returns a program matching the same strings as
+// program, with the same Split priorities (so engines reporting submatches report the same
+// ones), that is usually shorter and never longer:
+//
+//   - Jumps to Jumps, and Splits to Jumps, go straight to the final target.
+//   - Empty loops, such as the code for "()*", are collapsed: a branch of a Split that
+//     leads straight back to the Split without consuming anything is dropped.
+//   - A Split whose branches lead to the same place becomes a Jump.
+//   - Unreachable instructions and Jumps to the next instruction are removed.
+//
+// The instructions that remain keep their relative order, so a program ending in its only
+// Match still does (which UreSet relies on).
+//
+// If strings is set, runs of two or more Literals that can only be entered at their first
+// instruction are also fused into a single String instruction, which engines that consume
+// more than one byte per step can match with a memcmp. Most engines don't support String,
+// so the parser's output never contains it (see Parser).
+Program optimize(const Program& program, bool strings = false);
+
+}  // namespace ure
+
+#endif  // OPTIMIZER_H
@@ -0,0 +1,146 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "optimizer.h"
+#include "parser.h"
+
+using namespace std;
+using namespace ure;
+
+Program optimized(const string& pattern, bool strings = false) {
+  Parser parser(false, false);
+  return optimize(parser.parse(pattern), strings);
+}
+
+TEST(OptimizerTest, ThreadJumps) {
+  // The Jump after "a" goes to the loop's Jump, so it can go to the loop's Split instead.
+  Program expected = {
+    Instruction::Split(6),
+    Instruction::Split(3),
+    Instruction::Literal('a'),
+    Instruction::Jump(-3),
+    Instruction::Literal('b'),
+    Instruction::Jump(-5),
+    Instruction::Literal('c'),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimized("(a|b)*c"));
+
+  // Nothing to do.
+  Parser parser(false, false);
+  EXPECT_EQ(parser.parse("a(bb*)+a|.?[ab]"), optimized("a(bb*)+a|.?[ab]"));
+}
+
+TEST(OptimizerTest, EmptyLoops) {
+  Program expected = {
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimized("()*"));
+  EXPECT_EQ(expected, optimized("(|)*"));
+  EXPECT_EQ(expected, optimized("|"));
+  EXPECT_EQ(expected, optimized("(()?)+"));
+
+  expected = {
+    Instruction::Literal('x'),
+    Instruction::Literal('y'),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimized("x(()*)*y"));
+
+  // The inner loop's exit leads back to the outer loop, which isn't empty. It can't go
+  // straight there, since a backward Split would prefer leaving the inner loop.
+  expected = {
+    Instruction::Split(5),
+    Instruction::Split(3),
+    Instruction::Literal('a'),
+    Instruction::Jump(-2),
+    Instruction::Jump(-4),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimized("(a*)*"));
+}
+
+TEST(OptimizerTest, KeepsSplitPriorities) {
+  // The Split of "b?" prefers "b", so it can't be pointed at the loop's Split through the
+  // Jump after it, which would make it backwards and prefer repeating the loop.
+  Program expected = {
+    Instruction::Split(5),
+    Instruction::Literal('a'),
+    Instruction::Split(2),
+    Instruction::Literal('b'),
+    Instruction::Jump(-4),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimized("(ab?)*"));
+
+  // Jumps can still go straight to the loop's Split, like the one after "a".
+  expected = {
+    Instruction::Literal('b'),
+    Instruction::Split(9),
+    Instruction::Literal('c'),
+    Instruction::Split(3),
+    Instruction::Literal('a'),
+    Instruction::Jump(-4),
+    Instruction::Literal('c'),
+    Instruction::Split(2),
+    Instruction::Literal('b'),
+    Instruction::Jump(-8),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimized("b(c(a|cb?))*"));
+}
+
+TEST(OptimizerTest, KeepsSaves) {
+  Parser parser(false, false);
+  Program expected = {
+    Instruction::Save(0),
+    Instruction::Split(3),
+    Instruction::Save(2),
+    Instruction::Save(3),
+    Instruction::Save(1),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimize(parser.parse("()?", true)));
+}
+
+TEST(OptimizerTest, Strings) {
+  Program expected;
+  expected.push_back(expected.add_string("abc"));
+  expected.push_back(Instruction::Split(3));
+  expected.push_back(Instruction::Literal('d'));
+  expected.push_back(Instruction::Jump(2));
+  expected.push_back(expected.add_string("ef"));
+  expected.push_back(expected.add_string("gh"));
+  expected.push_back(Instruction::Match());
+  EXPECT_EQ(expected, optimized("abc(d|ef)gh", true));
+
+  // "b" starts each iteration of the loop, so it can't be fused with the "a" before it.
+  expected.clear();
+  expected.push_back(Instruction::Literal('a'));
+  expected.push_back(expected.add_string("bc"));
+  expected.push_back(Instruction::Split(-1));
+  expected.push_back(Instruction::Match());
+  EXPECT_EQ(expected, optimized("a(bc)+", true));
+
+  // Without strings, the same code but with Literals.
+  expected = {
+    Instruction::Literal('a'),
+    Instruction::Literal('b'),
+    Instruction::Literal('c'),
+    Instruction::Split(-2),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, optimized("a(bc)+"));
+}
+
+TEST(OptimizerTest, ParserOptimizesByDefault) {
+  Parser parser;
+  EXPECT_EQ(optimized("(a|b)*c"), parser.parse("(a|b)*c"));
+  // Errors are reported as before.
+  Parser unoptimized(false, false);
+  EXPECT_TRUE(parser.parse("a(b").empty());
+  EXPECT_TRUE(unoptimized.parse("a(b").empty());
+  EXPECT_EQ(unoptimized.error_info().idx, parser.error_info().idx);
+}
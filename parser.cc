@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <cctype>
+#include <cstdint>
 #include <iostream>
 #include <set>
+#include <utility>
 #include "parser.h"
 
 namespace ure {
@@ -24,11 +27,10 @@ bool Parser::consume(char c) {
   return false;
 }
 
-// Recursive descent parser that builds up a bytecode program based on the regular
-// expression. Each parse_* function handles an element in the EBNF grammar (described
-// in parser.h), trying to parse characters beginning at pattern[idx].
-// If parsing succeeds, it appends instructions onto the end of progam.
-// If parsing fails, it restore program and idx to their initial state.
+// Each parse_* function handles a character level element of the EBNF grammar (described
+// in parser.h), trying to parse characters beginning at pattern[idx]. If parsing succeeds,
+// it sets its argument to what it parsed. If parsing fails, it restores idx to its initial
+// state. Groups, alternation and repetition are handled by parse_tree().
 bool Parser::parse_class_escape(char& c) {
   if (!consume('\\')) return false;
   if (idx < pattern.size() && !isalnum(pattern[idx])) {
@@ -85,33 +87,34 @@ bool Parser::parse_class_element(CharacterClass& cclass) {
   return true;
 }
 
-bool Parser::parse_class(vector<Instruction>& program) {
+bool Parser::parse_class(Instruction& inst) {
   size_t initial_idx = idx;
   if (!consume('[')) return false;
 
-  unique_ptr<CharacterClass> cclass = make_unique<CharacterClass>();
-  cclass->negated = consume('^');
+  CharacterClass cclass;
+  cclass.negated = consume('^');
   if (consume('-')) {
-    cclass->characters.push_back('-');
+    cclass.characters.push_back('-');
   }
 
-  while (parse_class_element(*cclass)) {}
+  while (parse_class_element(cclass)) {}
 
   if (consume('-')) {
-    cclass->characters.push_back('-');
+    cclass.characters.push_back('-');
   }
   if (!consume(']')) {
     idx = initial_idx;
     return false;
   }
 
-  program.push_back(Instruction::Class(move(cclass)));
+  inst = Instruction::Class(classes.size());
+  classes.push_back(move(cclass));
   return true;
 }
 
-bool Parser::parse_literal(vector<Instruction>& program) {
+bool Parser::parse_literal(Instruction& inst) {
   if (idx < pattern.size() && reserved.count(pattern[idx]) == 0) {
-    program.push_back(Instruction::Literal(pattern[idx]));
+    inst = Instruction::Literal(pattern[idx]);
     if (debug) {
       cout << "Consumed " << pattern[idx] << endl;
     }
@@ -122,17 +125,17 @@ bool Parser::parse_literal(vector<Instruction>& program) {
   return false;
 }
 
-bool Parser::parse_escape(vector<Instruction>& program) {
+bool Parser::parse_escape(Instruction& inst) {
   if (!consume('\\')) return false;
   if (idx < pattern.size() && supported_built_in_classes.count(pattern[idx]) == 1) {
-    program.push_back(Instruction::Wildcard(pattern[idx]));
+    inst = Instruction::Wildcard(pattern[idx]);
     if (debug) {
       cout << "Consumed built-in character class " << pattern[idx] << endl;
     }
     idx++;
     return true;
   } else if (idx < pattern.size() && !isalnum(pattern[idx])) {
-    program.push_back(Instruction::Literal(pattern[idx]));
+    inst = Instruction::Literal(pattern[idx]);
     if (debug) {
       cout << "Consumed escaped " << pattern[idx] << endl;
     }
@@ -144,122 +147,233 @@ bool Parser::parse_escape(vector<Instruction>& program) {
   return false;
 }
 
-bool Parser::parse_wildcard(vector<Instruction>& program) {
+bool Parser::parse_wildcard(Instruction& inst) {
   if (!consume('.')) return false;
-  program.push_back(Instruction::Wildcard('.'));
+  inst = Instruction::Wildcard('.');
   return true;
 }
 
-bool Parser::parse_char(vector<Instruction>& program) {
-  return parse_escape(program)
-    || parse_wildcard(program)
-    || parse_literal(program)
-    || parse_class(program);
+bool Parser::parse_char(Instruction& inst) {
+  return parse_escape(inst)
+    || parse_wildcard(inst)
+    || parse_literal(inst)
+    || parse_class(inst);
 }
 
-bool Parser::parse_paren(vector<Instruction>& program) {
-  size_t initial_idx = idx;
-  size_t initial_pc = program.size();
-  if (!consume('(')) return false;
-  parse_alternate(program);
-  if (!consume(')')) {
-    idx = initial_idx;
-    program.resize(initial_pc);
-    return false;
+// Adds a node with the given children, computing the size of its code.
+uint32_t Parser::add_node(Node node, const uint32_t* first, size_t count) {
+  node.first_child = children.size();
+  node.num_children = count;
+  children.insert(children.end(), first, first + count);
+  node.size = 0;
+  for (size_t i = 0; i < count; i++) {
+    node.size += nodes[first[i]].size;
   }
-  return true;
-}
-
-bool Parser::parse_item(vector<Instruction>& program) {
-  ptrdiff_t initial_pc = program.size();
-  bool parsed = parse_paren(program) || parse_char(program);
-  if (!parsed) return false;
-
-  if (consume('?')) {
-    // a? compiles to:
-    //  0 Split 2
-    //  1 Literal a
-    //  2 ...
-    program.insert(program.begin() + initial_pc,
-                   Instruction::Split(program.size() + 1 - initial_pc));
-  } else if (consume('+')) {
-    // a+ compiles to:
-    //  0 Literal a
-    //  1 Split -1
-    //  2 ...
-    program.push_back(Instruction::Split(initial_pc - program.size()));
-  } else if (consume('*')) {
-    // a* compiles to:
-    //   0 Split 3
-    //   1 Literal a
-    //   2 Jmp -2
-    //   3 ...
-    program.insert(program.begin() + initial_pc,
-                   Instruction::Split(program.size() + 2 - initial_pc));
-    program.push_back(Instruction::Jump(initial_pc - program.size()));
+  switch (node.type) {
+    case NodeType::Char: node.size = 1; break;
+    case NodeType::Concat: break;
+    // A Split and a Jump for every alternative but the last, see generate().
+    case NodeType::Alternate: node.size += 2 * (count - 1); break;
+    case NodeType::Group: node.size += captures ? 2 : 0; break;
+    case NodeType::Repeat: node.size += node.op == '*' ? 2 : 1; break;
   }
+  nodes.push_back(node);
+  return nodes.size() - 1;
+}
 
-  return true;
+// Ends the innermost open group's current Concat (at a "|" or ")").
+void Parser::close_concat() {
+  const Frame& frame = frames.back();
+  Node concat{};
+  concat.type = NodeType::Concat;
+  uint32_t node = add_node(concat, items.data() + frame.first_item,
+                           items.size() - frame.first_item);
+  items.resize(frame.first_item);
+  alternatives.push_back(node);
 }
 
-bool Parser::parse_concat(vector<Instruction>& program) {
-  if (!parse_item(program)) return false;
-  parse_concat(program);
-  return true;
+// Ends the innermost open group (at its ")", or at the end of the pattern for group 0),
+// returning its node.
+uint32_t Parser::close_group() {
+  close_concat();
+  Frame frame = frames.back();
+  frames.pop_back();
+  size_t count = alternatives.size() - frame.first_alternative;
+  uint32_t body = alternatives.back();
+  if (count > 1) {
+    Node alternate{};
+    alternate.type = NodeType::Alternate;
+    body = add_node(alternate, alternatives.data() + frame.first_alternative, count);
+  }
+  alternatives.resize(frame.first_alternative);
+  Node group{};
+  group.type = NodeType::Group;
+  group.group = frame.group;
+  return add_node(group, &body, 1);
 }
 
-// Given regex like "a|b", produces code like:
-//
-//   0 Split 3
-//   1 Literal a
-//   2 Jmp 2
-//   3 Literal b
-//   4 (rest of regex)
-//
-// In the terminal case where the alternate contains only one option, avoids
-// producing any extra bytecode.
-bool Parser::parse_alternate(vector<Instruction>& program) {
-  ptrdiff_t initial_pc = program.size();
-
-  // We don't check the return value of the recursive calls, because we can
-  // always parse to an empty regex.
-  parse_concat(program);
-  if (!consume('|')) {
-    // "Alternate" is just a single clause, no special instructions needed.
-    return true;
+// Parses the whole pattern, setting root to the tree's root (the Group node for group 0).
+// On failure, sets idx to where the error is: the first character that can't be parsed,
+// or the "(" of the outermost group that isn't closed.
+bool Parser::parse_tree(uint32_t& root) {
+  frames.push_back({0, 0, items.size(), alternatives.size()});
+  while (true) {
+    uint32_t item;
+    Instruction inst;
+    if (consume('(')) {
+      frames.push_back({idx - 1, static_cast<uint32_t>(++num_groups), items.size(),
+                        alternatives.size()});
+      continue;
+    } else if (frames.size() > 1 && consume(')')) {
+      item = close_group();
+    } else if (consume('|')) {
+      close_concat();
+      continue;
+    } else if (parse_char(inst)) {
+      Node leaf{};
+      leaf.type = NodeType::Char;
+      leaf.inst = inst;
+      item = add_node(leaf, nullptr, 0);
+    } else {
+      break;
+    }
+
+    Node repeat{};
+    repeat.type = NodeType::Repeat;
+    if (consume('?') || consume('+') || consume('*')) {
+      repeat.op = pattern[idx - 1];
+      item = add_node(repeat, &item, 1);
+    }
+    items.push_back(item);
   }
 
-  // Now that we know there are two alternatives, splice a split instruction
-  // back into the program. Inserting in the middle of a vector is inefficient,
-  // but it should be fine unless regexes are extremely long.
-  program.insert(program.begin() + initial_pc,
-                 Instruction::Split(program.size() + 2 - initial_pc));
-
-  // Add the jump instruction. We need to parse what comes next before filling
-  // in the value of the jump offset.
-  ptrdiff_t jmp_pc = program.size();
-  program.push_back(Instruction::Jump(0));
-  parse_alternate(program);
-  program[jmp_pc].offset = program.size() - jmp_pc;
+  if (frames.size() > 1) {
+    idx = frames[1].open_idx;
+    return false;
+  }
+  if (idx < pattern.size()) return false;
+  root = close_group();
   return true;
 }
 
-vector<Instruction> Parser::parse(const string& pattern_) {
+// Lays out the code of each node, from the root down. Nodes come after their children, so
+// going through them backwards, each node's pc is known (set by its parent) by the time
+// it's reached, and it writes its own instructions and sets its children's pcs.
+Program Parser::generate(uint32_t root) {
+  vector<Instruction> code(nodes[root].size + 1);
+  nodes[root].pc = 0;
+  for (size_t n = root + 1; n-- > 0;) {
+    const Node& node = nodes[n];
+    const uint32_t* child = children.data() + node.first_child;
+    size_t pc = node.pc;
+    switch (node.type) {
+      case NodeType::Char:
+        code[pc] = node.inst;
+        break;
+      case NodeType::Concat:
+        // Reversed programs compile concatenations backwards (see parse()).
+        for (size_t i = 0; i < node.num_children; i++) {
+          Node& item = nodes[child[reverse ? node.num_children - 1 - i : i]];
+          item.pc = pc;
+          pc += item.size;
+        }
+        break;
+      case NodeType::Alternate: {
+        // "a|b|c" compiles to:
+        //
+        //   0 Split 3
+        //   1 Literal a
+        //   2 Jmp 5
+        //   3 Split 3
+        //   4 Literal b
+        //   5 Jmp 2
+        //   6 Literal c
+        //   7 (rest of regex)
+        size_t end = pc + node.size;
+        for (size_t i = 0; i + 1 < node.num_children; i++) {
+          Node& alternative = nodes[child[i]];
+          code[pc] = Instruction::Split(alternative.size + 2);
+          alternative.pc = pc + 1;
+          pc += alternative.size + 1;
+          code[pc] = Instruction::Jump(end - pc);
+          pc++;
+        }
+        nodes[child[node.num_children - 1]].pc = pc;
+        break;
+      }
+      case NodeType::Group:
+        if (captures) {
+          code[pc++] = Instruction::Save(2 * node.group + reverse);
+          code[node.pc + node.size - 1] = Instruction::Save(2 * node.group + !reverse);
+        }
+        nodes[child[0]].pc = pc;
+        break;
+      case NodeType::Repeat: {
+        Node& item = nodes[child[0]];
+        if (node.op == '?') {
+          // a? compiles to:
+          //  0 Split 2
+          //  1 Literal a
+          //  2 ...
+          code[pc] = Instruction::Split(item.size + 1);
+          item.pc = pc + 1;
+        } else if (node.op == '+') {
+          // a+ compiles to:
+          //  0 Literal a
+          //  1 Split -1
+          //  2 ...
+          item.pc = pc;
+          code[pc + item.size] = Instruction::Split(-static_cast<ptrdiff_t>(item.size));
+        } else {
+          // a* compiles to:
+          //   0 Split 3
+          //   1 Literal a
+          //   2 Jmp -2
+          //   3 ...
+          code[pc] = Instruction::Split(item.size + 2);
+          item.pc = pc + 1;
+          code[pc + item.size + 1] = Instruction::Jump(-static_cast<ptrdiff_t>(item.size) - 1);
+        }
+        break;
+      }
+    }
+  }
+  code.back() = Instruction::Match();
+  return Program(move(code), move(classes));
+}
+
+Program Parser::parse(const string& pattern_, bool captures_, bool reverse_) {
   pattern = pattern_;
   idx = 0;
-  vector<Instruction> program;
-  if (!parse_alternate(program)) return {};
-  if (idx < pattern.size()) return {};
-
-  program.push_back(Instruction::Match());
+  captures = captures_;
+  reverse = reverse_;
+  num_groups = 0;
+
+  uint32_t root;
+  bool parsed = parse_tree(root);
+  Program program = parsed ? generate(root) : Program();
+  release_tree();
+  if (!parsed) return program;
+  if (optimize) program = ure::optimize(program);
   if (debug) {
     cout << "Finished parsing " << program << endl;
   }
   return program;
 }
 
+// Frees the syntax tree, which takes memory proportional to the pattern, rather than just
+// clearing it: engines keep their Parser (for error_info()), and shouldn't keep the tree.
+void Parser::release_tree() {
+  vector<Node>().swap(nodes);
+  vector<uint32_t>().swap(children);
+  vector<CharacterClass>().swap(classes);
+  vector<Frame>().swap(frames);
+  vector<uint32_t>().swap(items);
+  vector<uint32_t>().swap(alternatives);
+}
+
 ParseError Parser::error_info() {
   return { .pattern = pattern, .idx = idx };
 }
 
-}  // namespace ure
\ No newline at end of file
+}  // namespace ure
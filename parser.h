@@ -2,11 +2,13 @@
 #define PARSER_H
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "instruction.h"
+#include "optimizer.h"
 
 namespace ure {
 
@@ -16,8 +18,10 @@ struct ParseError {
   std::size_t idx;
 };
 
-// Recursive-descent parser for regular expressions. Compiles parsed regular expression
-// to a bytecode program, see instruction.h.
+// Parser for regular expressions. Builds a syntax tree, keeping the groups still open in an
+// explicit stack rather than recursing, then compiles the tree to a bytecode program (see
+// instruction.h) in a single pass. Time and memory are linear in the length of the pattern,
+// and long or deeply nested patterns can't overflow the call stack.
 //
 // Implements the following EBNF grammar:
 //
@@ -54,37 +58,97 @@ struct ParseError {
 //   Escapes for reserved characters: \., \\, \?, etc.
 //   Predefined character classes: \d, \D, \w, \W, \s, \S
 //   User-defined character classes ([a-z], [^@], etc.)
+//   Capture groups: with captures enabled, each parenthesized group records where it
+//     matched using Save instructions. Groups are numbered from 1 in order of their "(",
+//     and group 0 is the whole match.
 //
 // Future work:
 //   Anchors (^, $)
 class Parser {
  public:
-  Parser(bool debug = false) : debug(debug) {}
+  // Unless optimize is false, programs are passed through optimize() (see optimizer.h)
+  // before being returned. Turning it off gives the code exactly as described by the
+  // grammar, which is what the parser's tests check.
+  Parser(bool debug = false, bool optimize = true)
+    : debug(debug), optimize(optimize), captures(false), reverse(false), num_groups(0) {}
 
   // Attempt to parse the regular expression.
-  // If successful, returns a vector of instructions.
-  // If unsuccessful, returns an empty vector. (Valid patterns can never produce
-  // an empty instruction vector, as it will at least have a Match instruction.)
-  std::vector<Instruction> parse(const std::string& pattern);
+  // If successful, returns the compiled program.
+  // If unsuccessful, returns an empty program. (Valid patterns can never produce
+  // an empty program, as it will at least have a Match instruction.)
+  // If captures is set, the program includes Save instructions for every group (see
+  // Instruction::Save). Otherwise parentheses only group.
+  //
+  // If reverse is set, the program matches the reverse of the strings the pattern
+  // matches, so it can be run backwards over a text, from its last byte to its first.
+  // (Every concatenation is compiled in reverse order.) With captures, each group's end is
+  // saved before its start, and positions count from the end of the text.
+  Program parse(const std::string& pattern, bool captures = false, bool reverse = false);
 
   // Access information about parse errors (only valid if parse() returned empty vector).
   ParseError error_info();
 
  private:
   std::string pattern;
-  std::size_t idx;
+  std::size_t idx = 0;
   bool debug;
+  bool optimize;
+  bool captures;
+  bool reverse;
+  // Number of groups opened so far, used to number capture slots.
+  std::size_t num_groups;
+
+  // A node of the syntax tree. Nodes are stored in nodes after their children, so the
+  // root is the last one. The children of a node are children[first_child] onwards.
+  enum class NodeType : std::uint8_t {
+    Char,       // inst
+    Concat,     // Items in order.
+    Alternate,  // Two or more Concats.
+    Group,      // A Concat or Alternate, in parentheses (group 0 is the whole pattern).
+    Repeat,     // An item followed by op ('?', '+' or '*').
+  };
+  struct Node {
+    NodeType type;
+    char op;
+    Instruction inst;
+    std::uint32_t group;
+    std::uint32_t first_child;
+    std::uint32_t num_children;
+    // Number of instructions the node compiles to, and where they start.
+    std::uint32_t size;
+    std::uint32_t pc;
+  };
+  // A group which is still open: where its "(" is, and where its items and alternatives
+  // start in the items and alternatives stacks.
+  struct Frame {
+    std::size_t open_idx;
+    std::uint32_t group;
+    std::size_t first_item;
+    std::size_t first_alternative;
+  };
+
+  // Only used during parse(), which frees them before returning (see release_tree()).
+  std::vector<Node> nodes;
+  std::vector<std::uint32_t> children;
+  std::vector<CharacterClass> classes;
+  std::vector<Frame> frames;
+  // The nodes of the items parsed so far in the open groups' current Concats, and of the
+  // Concats already closed by a "|".
+  std::vector<std::uint32_t> items;
+  std::vector<std::uint32_t> alternatives;
 
   bool consume(char c);
-  bool parse_alternate(std::vector<Instruction>& program);
-  bool parse_concat(std::vector<Instruction>& program);
-  bool parse_item(std::vector<Instruction>& program);
-  bool parse_paren(std::vector<Instruction>& program);
-  bool parse_char(std::vector<Instruction>& program);
-  bool parse_wildcard(std::vector<Instruction>& program);
-  bool parse_literal(std::vector<Instruction>& program);
-  bool parse_escape(std::vector<Instruction>& program);
-  bool parse_class(std::vector<Instruction>& program);
+  bool parse_tree(std::uint32_t& root);
+  Program generate(std::uint32_t root);
+  void release_tree();
+  std::uint32_t add_node(Node node, const std::uint32_t* first, std::size_t count);
+  void close_concat();
+  std::uint32_t close_group();
+  bool parse_char(Instruction& inst);
+  bool parse_wildcard(Instruction& inst);
+  bool parse_literal(Instruction& inst);
+  bool parse_escape(Instruction& inst);
+  bool parse_class(Instruction& inst);
   bool parse_class_element(CharacterClass& cclass);
   bool parse_class_char(char& c);
   bool parse_class_literal(char& c);
@@ -1,4 +1,5 @@
 #include <memory>
+#include <string>
 
 #include <gtest/gtest.h>
 
@@ -7,10 +8,19 @@
 using namespace std;
 using namespace ure;
 
+// The character class used by the first instruction of program, which should be a Class.
+CharacterClass first_class(const Program& program) {
+  if (program.empty() || program[0].type != IType::Class) {
+    ADD_FAILURE() << "Expected a Class instruction, got:\n" << program;
+    return CharacterClass();
+  }
+  return program.cclass(program[0]);
+}
+
 TEST(ParserTest, ValidParse) {
-  Parser parser;
-  vector<Instruction> re = parser.parse("a(bb*)+a|.?[ab]");
-  vector<Instruction> expected = {
+  Parser parser(false, false);  // Unoptimized, to check the code as parsed.
+  Program re = parser.parse("a(bb*)+a|.?[ab]");
+  Program expected({
     Instruction::Split(9),
     Instruction::Literal('a'),
     Instruction::Literal('b'),
@@ -22,9 +32,11 @@ TEST(ParserTest, ValidParse) {
     Instruction::Jump(4),
     Instruction::Split(2),
     Instruction::Wildcard('.'),
-    Instruction::Class(CharacterClass(false, {'a', 'b'}, {})),
+    Instruction::Class(0),
     Instruction::Match(),
-  };
+  }, {
+    CharacterClass(false, {'a', 'b'}, {}),
+  });
   ASSERT_EQ(expected, re);
 
   re = parser.parse(R"delim(\(\)\|\?\+\*\.\\\[\]\#)delim");
@@ -46,9 +58,9 @@ TEST(ParserTest, ValidParse) {
 }
 
 TEST(ParserTest, EmptyParse) {
-  Parser parser;
+  Parser parser(false, false);
 
-  vector<Instruction> expected = {
+  Program expected = {
     Instruction::Match()
   };
   ASSERT_EQ(expected, parser.parse(""));
@@ -71,7 +83,7 @@ TEST(ParserTest, EmptyParse) {
 
 TEST(ParserTest, InvalidParse) {
   Parser parser;
-  vector<Instruction> empty;
+  Program empty;
 
   ASSERT_EQ(empty, parser.parse("abc??"));
   ASSERT_EQ(4, parser.error_info().idx);
@@ -98,107 +110,107 @@ TEST(ParserTest, InvalidParse) {
 
 TEST(ParserTest, CharacterClasses) {
   Parser parser;
-  vector<Instruction> expected;
+  Program expected;
   // Basic functionality
 
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'a', 'b'}, {})),
-    parser.parse("[ab]").at(0)
+    CharacterClass(false, {'a', 'b'}, {}),
+    first_class(parser.parse("[ab]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {'a', 'b'}, {})),
-    parser.parse("[^ab]").at(0)
+    CharacterClass(true, {'a', 'b'}, {}),
+    first_class(parser.parse("[^ab]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {}, {{'a', 'z'}})),
-    parser.parse("[a-z]").at(0)
+    CharacterClass(false, {}, {{'a', 'z'}}),
+    first_class(parser.parse("[a-z]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {}, {{'a', 'z'}, {'A', 'Z'}})),
-    parser.parse("[a-zA-Z]").at(0)
+    CharacterClass(false, {}, {{'a', 'z'}, {'A', 'Z'}}),
+    first_class(parser.parse("[a-zA-Z]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {'a', ' ', '$'}, {{'A', 'Z'}, {'0', '9'}})),
-    parser.parse("[^a A-Z$0-9]").at(0)
+    CharacterClass(true, {'a', ' ', '$'}, {{'A', 'Z'}, {'0', '9'}}),
+    first_class(parser.parse("[^a A-Z$0-9]"))
   );
   // Valid parses that are corner cases (see design_notes.md for details).
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {}, {})),
-    parser.parse("[]").at(0)
+    CharacterClass(false, {}, {}),
+    first_class(parser.parse("[]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {}, {})),
-    parser.parse("[^]").at(0)
+    CharacterClass(true, {}, {}),
+    first_class(parser.parse("[^]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {'^'}, {})),
-    parser.parse("[^^]").at(0)
+    CharacterClass(true, {'^'}, {}),
+    first_class(parser.parse("[^^]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'-', 'a'}, {})),
-    parser.parse("[-a]").at(0)
+    CharacterClass(false, {'-', 'a'}, {}),
+    first_class(parser.parse("[-a]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'a', '-'}, {})),
-    parser.parse("[a-]").at(0)
+    CharacterClass(false, {'a', '-'}, {}),
+    first_class(parser.parse("[a-]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {'-'}, {})),
-    parser.parse("[^-]").at(0)
+    CharacterClass(true, {'-'}, {}),
+    first_class(parser.parse("[^-]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {'a', '-'}, {})),
-    parser.parse("[^a-]").at(0)
+    CharacterClass(true, {'a', '-'}, {}),
+    first_class(parser.parse("[^a-]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {'-', 'a'}, {})),
-    parser.parse("[^-a]").at(0)
+    CharacterClass(true, {'-', 'a'}, {}),
+    first_class(parser.parse("[^-a]"))
   );
 
   // Escapes
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'^'}, {})),
-    parser.parse("[\\^]").at(0)
+    CharacterClass(false, {'^'}, {}),
+    first_class(parser.parse("[\\^]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(true, {'^'}, {})),
-    parser.parse("[^\\^]").at(0)
+    CharacterClass(true, {'^'}, {}),
+    first_class(parser.parse("[^\\^]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'a', '-', 'b'}, {})),
-    parser.parse("[a\\-b]").at(0)
+    CharacterClass(false, {'a', '-', 'b'}, {}),
+    first_class(parser.parse("[a\\-b]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'-', 'a'}, {})),
-    parser.parse("[\\-a]").at(0)
+    CharacterClass(false, {'-', 'a'}, {}),
+    first_class(parser.parse("[\\-a]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'a', '-'}, {})),
-    parser.parse("[a\\-]").at(0)
+    CharacterClass(false, {'a', '-'}, {}),
+    first_class(parser.parse("[a\\-]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'\\'}, {})),
-    parser.parse("[\\\\]").at(0)
+    CharacterClass(false, {'\\'}, {}),
+    first_class(parser.parse("[\\\\]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {']'}, {})),
-    parser.parse("[\\]]").at(0)
+    CharacterClass(false, {']'}, {}),
+    first_class(parser.parse("[\\]]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'['}, {})),
-    parser.parse("[\\[]").at(0)
+    CharacterClass(false, {'['}, {}),
+    first_class(parser.parse("[\\[]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'.', '*', '?', '|', '+', '(', ')'}, {})),
-    parser.parse("[.*?|+()]").at(0)  // These symbols don't need to be escaped inside character class
+    CharacterClass(false, {'.', '*', '?', '|', '+', '(', ')'}, {}),
+    first_class(parser.parse("[.*?|+()]"))  // These symbols don't need to be escaped inside character class
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'.', '*', '?', '|', '+', '(', ')'}, {})),
-    parser.parse("[\\.\\*\\?\\|\\+\\(\\)]").at(0)  // But they can be optionally
+    CharacterClass(false, {'.', '*', '?', '|', '+', '(', ')'}, {}),
+    first_class(parser.parse("[\\.\\*\\?\\|\\+\\(\\)]"))  // But they can be optionally
   );
 
   // Invalid parses
-  vector<Instruction> empty;
+  Program empty;
   ASSERT_EQ(empty, parser.parse("[]ab]"));
   ASSERT_EQ(4, parser.error_info().idx);
 
@@ -214,11 +226,117 @@ TEST(ParserTest, CharacterClasses) {
   // Redundant classes. Not sure how I should handle this.
   // For now, I'll just let them be added. It's slightly inefficient but will still work correctly.
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {'a', 'a'}, {})),
-    parser.parse("[aa]").at(0)
+    CharacterClass(false, {'a', 'a'}, {}),
+    first_class(parser.parse("[aa]"))
   );
   EXPECT_EQ(
-    Instruction::Class(CharacterClass(false, {}, {{'a', 'z'}, {'a', 'z'}})),
-    parser.parse("[a-za-z]").at(0)
+    CharacterClass(false, {}, {{'a', 'z'}, {'a', 'z'}}),
+    first_class(parser.parse("[a-za-z]"))
   );
-}
\ No newline at end of file
+}
+
+TEST(ParserTest, ClassTable) {
+  Parser parser;
+  Program a = parser.parse("[ab]x[^c]");
+  Program b = parser.parse("[d-f]");
+  ASSERT_EQ(2, a.class_table().size());
+  EXPECT_EQ(Instruction::Class(1), a[2]);
+
+  // Appending re-indexes the class references of the appended program.
+  Program combined = a;
+  combined.append(b);
+  ASSERT_EQ(3, combined.class_table().size());
+  EXPECT_EQ(CharacterClass(false, {}, {{'d', 'f'}}), combined.cclass(combined[a.size()]));
+
+  Program unanchored = a.unanchored();
+  ASSERT_EQ(Instruction::match_all.size() + a.size(), unanchored.size());
+  EXPECT_EQ(CharacterClass(true, {'c'}, {}),
+            unanchored.cclass(unanchored[Instruction::match_all.size() + 2]));
+
+  // Classes whose instructions are dropped are dropped from the table too.
+  a.resize(1);
+  EXPECT_EQ(1, a.class_table().size());
+}
+
+TEST(ParserTest, Captures) {
+  Parser parser(false, false);
+  Program expected = {
+    Instruction::Save(0),
+    Instruction::Split(5),
+    Instruction::Save(2),
+    Instruction::Literal('a'),
+    Instruction::Save(3),
+    Instruction::Jump(-4),
+    Instruction::Save(4),
+    Instruction::Save(6),
+    Instruction::Literal('b'),
+    Instruction::Save(7),
+    Instruction::Save(5),
+    Instruction::Save(1),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, parser.parse("(a)*((b))", true));
+
+  // Parse errors are unaffected, and group 0 is always the whole match.
+  EXPECT_TRUE(parser.parse("(a", true).empty());
+  Program no_groups = parser.parse("a", true);
+  EXPECT_EQ(Program({Instruction::Save(0), Instruction::Literal('a'), Instruction::Save(1),
+                     Instruction::Match()}), no_groups);
+
+  // Without captures, parentheses don't add any instructions.
+  EXPECT_EQ(parser.parse("a*b"), parser.parse("(a)*((b))"));
+}
+
+TEST(ParserTest, Reverse) {
+  Parser parser(false, false);
+  // Concatenations are reversed, at every level, but alternatives and loops keep their
+  // shape.
+  Program expected = {
+    Instruction::Literal('d'),
+    Instruction::Split(3),
+    Instruction::Literal('b'),
+    Instruction::Jump(2),
+    Instruction::Literal('c'),
+    Instruction::Split(-4),
+    Instruction::Literal('a'),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, parser.parse("a(b|c)+d", false, true));
+  EXPECT_EQ(parser.parse("cba"), parser.parse("abc", false, true));
+  EXPECT_EQ(parser.parse("(dc|e)*ba"), parser.parse("ab(cd|e)*", false, true));
+
+  // Each group's end is saved first.
+  expected = {
+    Instruction::Save(1),
+    Instruction::Literal('b'),
+    Instruction::Save(3),
+    Instruction::Literal('a'),
+    Instruction::Save(2),
+    Instruction::Save(0),
+    Instruction::Match(),
+  };
+  EXPECT_EQ(expected, parser.parse("(a)b", true, true));
+
+  EXPECT_TRUE(parser.parse("a(b", false, true).empty());
+  EXPECT_EQ(1, parser.error_info().idx);
+}
+
+TEST(ParserTest, LongPatterns) {
+  Parser parser(false, false);
+  // Deep nesting and long concatenations are parsed without recursion.
+  const size_t depth = 200000;
+  string nested = string(depth, '(') + "a" + string(depth, ')');
+  Program expected = {
+    Instruction::Literal('a'),
+    Instruction::Match(),
+  };
+  ASSERT_EQ(expected, parser.parse(nested));
+
+  string items;
+  for (size_t i = 0; i < depth; i++) items += "a*";
+  ASSERT_EQ(3 * depth + 1, parser.parse(items).size());
+
+  // The error is at the outermost group that isn't closed.
+  ASSERT_TRUE(parser.parse("x" + nested.substr(0, nested.size() - 1)).empty());
+  ASSERT_EQ(1, parser.error_info().idx);
+}
@@ -0,0 +1,188 @@
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "prefilter.h"
+
+namespace ure {
+
+using namespace std;
+
+// Successors of pc in the program's control flow graph. Match instructions all lead to a
+// single virtual exit node, numbered program.size().
+vector<size_t> successors(const Program& program, size_t pc) {
+  const Instruction& inst = program[pc];
+  switch (inst.type) {
+    case IType::Literal:  // fallthrough
+    case IType::Wildcard:  // fallthrough
+    case IType::Class:  // fallthrough
+    case IType::Save:  // fallthrough
+    case IType::String:
+      return {pc + 1};
+    case IType::Jump:
+      return {pc + inst.offset};
+    case IType::Split:
+      return {pc + 1, pc + inst.offset};
+    case IType::Match:
+      return {program.size()};
+    default:
+      return {};
+  }
+}
+
+// Computes the immediate dominator of each node reachable from pc 0, using the iterative
+// algorithm from Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm" (2001).
+// Unreachable nodes get an immediate dominator of -1, and pc 0 is its own dominator.
+vector<int> immediate_dominators(const Program& program) {
+  size_t num_nodes = program.size() + 1;
+
+  // Number the nodes in postorder with an iterative depth first search.
+  vector<int> postorder_number(num_nodes, -1);
+  vector<size_t> postorder;
+  vector<bool> visited(num_nodes, false);
+  vector<pair<size_t, size_t>> stack = {{0, 0}};  // (node, index of next successor)
+  vector<vector<size_t>> succs(num_nodes);
+  vector<vector<size_t>> preds(num_nodes);
+  visited[0] = true;
+  succs[0] = successors(program, 0);
+  while (!stack.empty()) {
+    size_t node = stack.back().first;
+    size_t& next = stack.back().second;
+    if (next < succs[node].size()) {
+      size_t succ = succs[node][next++];
+      if (succ >= num_nodes) continue;
+      preds[succ].push_back(node);
+      if (!visited[succ]) {
+        visited[succ] = true;
+        if (succ < program.size()) succs[succ] = successors(program, succ);
+        stack.push_back({succ, 0});
+      }
+    } else {
+      postorder_number[node] = postorder.size();
+      postorder.push_back(node);
+      stack.pop_back();
+    }
+  }
+
+  vector<int> idom(num_nodes, -1);
+  idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    // Reverse postorder, skipping the entry node (which is last in postorder).
+    for (size_t i = postorder.size() - 1; i-- > 0;) {
+      size_t node = postorder[i];
+      int new_idom = -1;
+      for (size_t pred : preds[node]) {
+        if (idom[pred] == -1) continue;
+        if (new_idom == -1) {
+          new_idom = pred;
+          continue;
+        }
+        // Walk up the dominator tree from both nodes until they meet.
+        int a = pred, b = new_idom;
+        while (a != b) {
+          while (postorder_number[a] < postorder_number[b]) a = idom[a];
+          while (postorder_number[b] < postorder_number[a]) b = idom[b];
+        }
+        new_idom = a;
+      }
+      if (idom[node] != new_idom) {
+        idom[node] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  return idom;
+}
+
+string required_literal(const Program& program) {
+  if (program.empty()) return "";
+  vector<int> idom = immediate_dominators(program);
+
+  // The dominators of the exit node are the instructions on every path to a Match.
+  string best;
+  size_t exit = program.size();
+  if (idom[exit] == -1) return "";
+  for (size_t pc = idom[exit]; ; pc = idom[pc]) {
+    if (program[pc].type == IType::Literal) {
+      string run;
+      for (size_t i = pc; i < program.size() && program[i].type == IType::Literal; i++) {
+        run += program[i].c;
+      }
+      if (run.size() > best.size()) best = run;
+    }
+    if (pc == 0) break;
+  }
+  return best;
+}
+
+string literal_prefix(const Program& program) {
+  string prefix;
+  for (size_t pc = 0; pc < program.size() && program[pc].type == IType::Literal; pc++) {
+    prefix += program[pc].c;
+  }
+  return prefix;
+}
+
+bool is_literal(const Program& program, string& literal) {
+  if (program.empty() || program.back().type != IType::Match) return false;
+  string s;
+  for (size_t pc = 0; pc + 1 < program.size(); pc++) {
+    if (program[pc].type != IType::Literal) return false;
+    s += program[pc].c;
+  }
+  literal = s;
+  return true;
+}
+
+bool first_bytes(const Program& program, ByteSet& bytes) {
+  bytes = ByteSet();
+  vector<bool> visited(program.size(), false);
+  vector<size_t> stack = {0};
+  while (!stack.empty()) {
+    size_t pc = stack.back();
+    stack.pop_back();
+    if (pc >= program.size() || visited[pc]) continue;
+    visited[pc] = true;
+
+    const Instruction& inst = program[pc];
+    switch (inst.type) {
+      case IType::Literal:
+        bytes.insert(inst.c);
+        break;
+      case IType::String:
+        bytes.insert(program.string_of(inst)[0]);
+        break;
+      case IType::Wildcard:  // fallthrough
+      case IType::Class:
+        bytes |= program.byte_set(inst);
+        break;
+      case IType::Jump:
+        stack.push_back(pc + inst.offset);
+        break;
+      case IType::Save:
+        stack.push_back(pc + 1);
+        break;
+      case IType::Split:
+        stack.push_back(pc + 1);
+        stack.push_back(pc + inst.offset);
+        break;
+      case IType::Match:
+        return false;
+    }
+  }
+  return true;
+}
+
+bool contains_literal(const string& text, const string& literal) {
+  return contains_literal(text.data(), text.size(), literal);
+}
+
+bool contains_literal(const char* data, size_t size, const string& literal) {
+  return memmem(data, size, literal.data(), literal.size()) != nullptr;
+}
+
+}  // namespace ure
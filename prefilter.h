@@ -0,0 +1,44 @@
+#ifndef PREFILTER_H
+#define PREFILTER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+
+namespace ure {
+
+// Returns the longest string that every text matched by program must contain, or "" if
+// there isn't one. For example, "(a|b)*ERROR: \d+" requires "ERROR: ".
+//
+// A Literal instruction is required if it dominates every Match instruction in the
+// program's control flow graph, i.e. there's no way to reach a Match without executing
+// it. Since a Literal always falls through to the next instruction, a required Literal
+// and the run of Literals following it always match consecutive characters, so the whole
+// run is required.
+std::string required_literal(const Program& program);
+
+// Returns the string every match of program starts with, i.e. the run of Literal
+// instructions at pc 0, since every path through the program starts there. For example
+// "ab(c|d)" starts with "ab". Applied to a reversed program (see Parser::parse), gives the
+// string every match ends with, reversed.
+std::string literal_prefix(const Program& program);
+
+// If program only matches a single fixed string (i.e. it's a run of Literal instructions
+// followed by Match), sets literal to that string and returns true.
+bool is_literal(const Program& program, std::string& literal);
+
+// Computes the set of bytes a match of program can start with, i.e. the bytes accepted by
+// the consuming instructions reachable from pc 0 through Jump and Split. Returns false if
+// program can match the empty string, in which case no such set exists.
+bool first_bytes(const Program& program, ByteSet& bytes);
+
+// Fast substring search (memmem), used to skip texts that can't match before running the
+// full engine.
+bool contains_literal(const std::string& text, const std::string& literal);
+bool contains_literal(const char* data, std::size_t size, const std::string& literal);
+
+}  // namespace ure
+
+#endif  // PREFILTER_H
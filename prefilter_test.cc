@@ -0,0 +1,116 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "parser.h"
+#include "prefilter.h"
+
+using namespace std;
+using namespace ure;
+
+string literal_for(const string& pattern) {
+  Parser parser;
+  return required_literal(parser.parse(pattern));
+}
+
+TEST(PrefilterTest, RequiredLiteral) {
+  EXPECT_EQ("ERROR: ", literal_for("(a|b)*ERROR: \\d+"));
+  EXPECT_EQ("hello", literal_for("x*hello"));
+  EXPECT_EQ("bcd", literal_for("a?bcd"));
+  // The first run of a (bc)+ loop is always preceded by the a.
+  EXPECT_EQ("abc", literal_for("a(bc)+d"));
+  EXPECT_EQ("world", literal_for("hi.world"));
+  EXPECT_EQ("cd", literal_for("(ab)*cd(ef)*"));
+
+  // Nothing is required.
+  EXPECT_EQ("", literal_for(""));
+  EXPECT_EQ("", literal_for("a|b"));
+  EXPECT_EQ("", literal_for("(abc|abd)"));
+  EXPECT_EQ("", literal_for("(abc)?"));
+  EXPECT_EQ("", literal_for("\\d+[a-z]*"));
+}
+
+TEST(PrefilterTest, IsLiteral) {
+  Parser parser;
+  string literal = "unchanged";
+  EXPECT_TRUE(is_literal(parser.parse("abc\\.d"), literal));
+  EXPECT_EQ("abc.d", literal);
+  EXPECT_TRUE(is_literal(parser.parse(""), literal));
+  EXPECT_EQ("", literal);
+
+  literal = "unchanged";
+  EXPECT_FALSE(is_literal(parser.parse("ab?c"), literal));
+  EXPECT_FALSE(is_literal(parser.parse("a.c"), literal));
+  EXPECT_FALSE(is_literal(parser.parse("[a]"), literal));
+  EXPECT_FALSE(is_literal(parser.parse("a|b"), literal));
+  EXPECT_FALSE(is_literal(parser.parse("a("), literal));
+  EXPECT_EQ("unchanged", literal);
+}
+
+TEST(PrefilterTest, ContainsLiteral) {
+  EXPECT_TRUE(contains_literal("abc", ""));
+  EXPECT_TRUE(contains_literal("", ""));
+  EXPECT_TRUE(contains_literal("xxERRORxx", "ERROR"));
+  EXPECT_FALSE(contains_literal("xxERRxx", "ERROR"));
+  EXPECT_TRUE(contains_literal(string("a\0b", 3), string("\0b", 2)));
+}
+
+TEST(PrefilterTest, FirstBytes) {
+  Parser parser;
+  ByteSet bytes;
+  EXPECT_TRUE(first_bytes(parser.parse("(ab|c[x-z])d*"), bytes));
+  ByteSet expected;
+  expected.insert('a');
+  expected.insert('c');
+  EXPECT_EQ(expected, bytes);
+
+  EXPECT_TRUE(first_bytes(parser.parse("a*\\d"), bytes));
+  expected = ByteSet();
+  for (char c : string("a0123456789")) expected.insert(c);
+  EXPECT_EQ(expected, bytes);
+
+  // Can match the empty string.
+  EXPECT_FALSE(first_bytes(parser.parse("a*"), bytes));
+  EXPECT_FALSE(first_bytes(parser.parse("(a|)b?"), bytes));
+}
+
+TEST(PrefilterTest, LiteralPrefix) {
+  Parser parser;
+  EXPECT_EQ("ab", literal_prefix(parser.parse("ab(c|d)")));
+  EXPECT_EQ("ab", literal_prefix(parser.parse("ab+")));
+  EXPECT_EQ("", literal_prefix(parser.parse("a*b")));
+  EXPECT_EQ("", literal_prefix(parser.parse("ab|ac")));
+  // The suffix every match ends with, from the reversed program.
+  EXPECT_EQ("nosj.", literal_prefix(parser.parse(".*\\.json", false, true)));
+}
+
+TEST(PrefilterTest, FindFirstIn) {
+  // Compare against a simple loop for every offset of the match in texts long enough to
+  // use the vector code, for sets covering both halves of the byte range.
+  vector<ByteSet> sets(4);
+  sets[0].insert('x');
+  sets[1].insert('\xff');
+  sets[1].insert('\x80');
+  sets[1].insert('\x7f');
+  sets[2] = built_in_class('w');
+  sets[3] = built_in_class('D');
+  for (const ByteSet& set : sets) {
+    for (size_t size : {0, 1, 31, 32, 33, 64, 100, 300}) {
+      for (size_t pos = 0; pos <= size; pos++) {
+        string text(size, '\0');
+        for (size_t i = 0; i < size; i++) {
+          // Bytes not in the set, cycling through as many values as possible.
+          char c = static_cast<char>(i * 7);
+          while (set.contains(c)) c++;
+          text[i] = c;
+        }
+        char hit = '\0';
+        while (!set.contains(hit)) hit++;
+        if (pos < size) text[pos] = hit;
+        EXPECT_EQ(pos, find_first_in(set, text.data(), text.size()))
+            << "size " << size << ", pos " << pos;
+      }
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "program_cache.h"
+
+namespace ure {
+
+using namespace std;
+
+ProgramCache& ProgramCache::global() {
+  // Never destroyed, so it can still be used by other static objects' destructors.
+  static ProgramCache* cache = new ProgramCache();
+  return *cache;
+}
+
+shared_ptr<const NfaProgram> ProgramCache::get(const string& pattern) {
+  {
+    lock_guard<mutex> lock(entries_mutex);
+    auto it = index.find(pattern);
+    if (it != index.end()) {
+      counters.hits++;
+      entries.splice(entries.begin(), entries, it->second);
+      return it->second->second;
+    }
+    counters.misses++;
+  }
+
+  shared_ptr<const NfaProgram> program = compile_nfa(pattern);
+
+  lock_guard<mutex> lock(entries_mutex);
+  auto it = index.find(pattern);
+  if (it != index.end()) {
+    // Another thread compiled it in the meantime.
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->second;
+  }
+  if (capacity == 0) return program;
+  evict_to(capacity - 1);
+  entries.emplace_front(pattern, program);
+  index.emplace(pattern, entries.begin());
+  return program;
+}
+
+ProgramCache::Stats ProgramCache::stats() const {
+  lock_guard<mutex> lock(entries_mutex);
+  Stats stats = counters;
+  stats.size = entries.size();
+  return stats;
+}
+
+void ProgramCache::set_capacity(size_t capacity_) {
+  lock_guard<mutex> lock(entries_mutex);
+  capacity = capacity_;
+  evict_to(capacity);
+}
+
+void ProgramCache::clear() {
+  lock_guard<mutex> lock(entries_mutex);
+  entries.clear();
+  index.clear();
+  counters = Stats();
+}
+
+void ProgramCache::evict_to(size_t size) {
+  while (entries.size() > size) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+    counters.evictions++;
+  }
+}
+
+}  // namespace ure
@@ -0,0 +1,72 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "ure_nfa.h"
+
+namespace ure {
+
+// Default number of patterns kept by ProgramCache::global().
+const std::size_t default_program_cache_size = 4096;
+
+// A cache of compiled UreNfa programs, keyed by pattern, holding at most capacity of them.
+// When it's full, the least recently used program is evicted to make room. Programs are
+// immutable and shared, so a program stays valid for as long as someone holds it, even if
+// it's been evicted:
+//
+//   UreNfa re(ProgramCache::global().get(pattern));
+//
+// Patterns which don't parse are cached too, as programs with an empty re and the parse
+// error (see UreNfa::parsing_failed and parser_error_info).
+//
+// All methods are thread-safe. Compilation happens outside the lock, so a slow pattern
+// doesn't hold up lookups of others. If several threads miss on the same pattern at once,
+// each compiles it, and the first to finish wins.
+class ProgramCache {
+ public:
+  explicit ProgramCache(std::size_t capacity = default_program_cache_size)
+    : capacity(capacity) {}
+
+  // The process-wide cache, created with default_program_cache_size on first use.
+  static ProgramCache& global();
+
+  // Returns the compiled program for pattern, compiling it on a miss.
+  std::shared_ptr<const NfaProgram> get(const std::string& pattern);
+
+  struct Stats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+    std::size_t size = 0;
+  };
+  Stats stats() const;
+
+  // Evicts programs until at most capacity are left, and keeps it that way.
+  void set_capacity(std::size_t capacity);
+  // Evicts every program (which isn't counted in the evictions stat) and resets the stats.
+  void clear();
+
+ private:
+  // Most recently used first.
+  using Entry = std::pair<std::string, std::shared_ptr<const NfaProgram>>;
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  std::size_t capacity;
+  Stats counters;
+  mutable std::mutex entries_mutex;
+
+  // Requires the lock.
+  void evict_to(std::size_t size);
+};
+
+}  // namespace ure
+
+#endif  // PROGRAM_CACHE_H
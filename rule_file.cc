@@ -0,0 +1,314 @@
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "rule_file.h"
+
+namespace ure {
+
+using namespace std;
+
+// File layout:
+//
+//   Header
+//   Rule[num_rules]
+//   sections, each starting at a multiple of 8 bytes
+//
+// Sections are arrays of the types below, or of char, Instruction, uint32_t (DFA
+// transitions) and uint8_t (DFA accepting flags).
+
+const char rule_file_magic[8] = {'U', 'R', 'E', 'R', 'U', 'L', 'E', 'S'};
+// Reads as 0x01020304 only if the file was written with the same byte order.
+const uint32_t rule_file_byte_order = 0x01020304;
+const size_t section_alignment = 8;
+
+struct RuleFile::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t file_size;
+  uint64_t num_rules;
+};
+
+// Offset from the start of the file and size, both in bytes.
+struct RuleFile::Section {
+  uint64_t offset;
+  uint64_t size;
+};
+
+// A character class: its characters are class_bytes[first_character, +num_characters),
+// and its ranges are pairs of bytes from class_bytes[first_range, +2 * num_ranges).
+struct ClassRecord {
+  uint32_t negated;
+  uint32_t first_character;
+  uint32_t num_characters;
+  uint32_t first_range;
+  uint32_t num_ranges;
+};
+
+struct DfaRecord {
+  RuleFile::Section next;
+  RuleFile::Section accepting;
+  uint32_t start;
+  uint32_t stop;
+};
+
+struct RuleFile::Rule {
+  Section pattern;
+  Section code;
+  Section classes;
+  Section class_bytes;
+  // Full and partial DFAs, only meaningful if has_dfa is set.
+  DfaRecord dfas[2];
+  uint32_t has_dfa;
+  uint32_t padding;
+};
+
+static_assert(sizeof(Instruction) == 8, "Instructions are stored as 8 byte values");
+static_assert(sizeof(RuleFile::Header) % section_alignment == 0, "Header is padded");
+static_assert(sizeof(RuleFile::Rule) % section_alignment == 0, "Rule is padded");
+
+// Builds a rule file in memory, section by section.
+class RuleFileWriter {
+ public:
+  RuleFileWriter(size_t num_rules)
+    : buffer(sizeof(RuleFile::Header) + num_rules * sizeof(RuleFile::Rule), '\0') {}
+
+  RuleFile::Section add(const void* data, size_t size) {
+    buffer.resize((buffer.size() + section_alignment - 1) / section_alignment
+                  * section_alignment, '\0');
+    RuleFile::Section section = {buffer.size(), size};
+    buffer.append(static_cast<const char*>(data), size);
+    return section;
+  }
+
+  void add_rule(size_t i, const string& pattern, const Program& program,
+                const DenseDfa* dfas) {
+    RuleFile::Rule rule{};
+    rule.pattern = add(pattern.data(), pattern.size());
+    rule.code = add(program.data(), program.size() * sizeof(Instruction));
+
+    vector<ClassRecord> classes;
+    string class_bytes;
+    for (const CharacterClass& cclass : program.class_table()) {
+      ClassRecord record{};
+      record.negated = cclass.negated;
+      record.first_character = class_bytes.size();
+      record.num_characters = cclass.characters.size();
+      class_bytes.append(cclass.characters.begin(), cclass.characters.end());
+      record.first_range = class_bytes.size();
+      record.num_ranges = cclass.ranges.size();
+      for (const pair<char, char>& range : cclass.ranges) {
+        class_bytes += range.first;
+        class_bytes += range.second;
+      }
+      classes.push_back(record);
+    }
+    rule.classes = add(classes.data(), classes.size() * sizeof(ClassRecord));
+    rule.class_bytes = add(class_bytes.data(), class_bytes.size());
+
+    rule.has_dfa = dfas != nullptr;
+    for (int partial = 0; partial < 2 && dfas != nullptr; partial++) {
+      const DenseDfa& dfa = dfas[partial];
+      DfaRecord& record = rule.dfas[partial];
+      record.next = add(dfa.next, dfa.num_states() * 256 * sizeof(uint32_t));
+      record.accepting = add(dfa.accepting, dfa.num_states());
+      record.start = dfa.start;
+      record.stop = dfa.stop;
+    }
+    size_t offset = sizeof(RuleFile::Header) + i * sizeof(RuleFile::Rule);
+    memcpy(&buffer[offset], &rule, sizeof(rule));
+  }
+
+  const string& finish(size_t num_rules) {
+    RuleFile::Header header{};
+    memcpy(header.magic, rule_file_magic, sizeof(header.magic));
+    header.version = rule_file_version;
+    header.byte_order = rule_file_byte_order;
+    header.file_size = buffer.size();
+    header.num_rules = num_rules;
+    memcpy(&buffer[0], &header, sizeof(header));
+    return buffer;
+  }
+
+ private:
+  string buffer;
+};
+
+bool write_rule_file(const string& path, const vector<string>& patterns,
+                     size_t max_dfa_states) {
+  RuleFileWriter writer(patterns.size());
+  Parser parser;
+  for (size_t i = 0; i < patterns.size(); i++) {
+    Program program = parser.parse(patterns[i]);
+    if (program.empty()) {
+      cerr << "Can't parse pattern " << i << " at position " << parser.error_info().idx
+           << ": " << patterns[i] << endl;
+      return false;
+    }
+    DenseDfa dfas[2];
+    bool has_dfa = build_dense_dfa(program, false, max_dfa_states, dfas[0])
+                   && build_dense_dfa(program.unanchored(), true, max_dfa_states, dfas[1]);
+    writer.add_rule(i, patterns[i], program, has_dfa ? dfas : nullptr);
+  }
+  const string& buffer = writer.finish(patterns.size());
+
+  ofstream out(path, ios::binary | ios::trunc);
+  out.write(buffer.data(), buffer.size());
+  out.close();
+  if (!out) {
+    cerr << path << ": can't write rule file" << endl;
+    return false;
+  }
+  return true;
+}
+
+template <typename T>
+const T* RuleFile::section(const Section& s) const {
+  return reinterpret_cast<const T*>(data + s.offset);
+}
+
+// Whether s lies within a file of file_size bytes, is aligned and holds whole Ts.
+template <typename T>
+bool valid_section(const RuleFile::Section& s, size_t file_size) {
+  return s.offset % section_alignment == 0 && s.offset <= file_size
+         && s.size <= file_size - s.offset && s.size % sizeof(T) == 0;
+}
+
+// Whether state is the start of one of a DFA's rows.
+bool valid_state(uint32_t state, size_t rows) { return state % 256 == 0 && state / 256 < rows; }
+
+shared_ptr<const RuleFile> RuleFile::open(const string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << path << ": " << strerror(errno) << endl;
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    cerr << path << ": " << strerror(errno) << endl;
+    close(fd);
+    return nullptr;
+  }
+  shared_ptr<RuleFile> file(new RuleFile());
+  if (static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapped != MAP_FAILED) {
+      file->data = static_cast<const char*>(mapped);
+      file->file_size = st.st_size;
+    }
+  }
+  close(fd);
+  if (file->data == nullptr) {
+    cerr << path << ": not a rule file" << endl;
+    return nullptr;
+  }
+
+  Header header;
+  memcpy(&header, file->data, sizeof(header));
+  if (memcmp(header.magic, rule_file_magic, sizeof(header.magic)) != 0
+      || header.byte_order != rule_file_byte_order || header.file_size != file->file_size
+      || (file->file_size - sizeof(Header)) / sizeof(Rule) < header.num_rules) {
+    cerr << path << ": not a rule file, or written on a host with another byte order"
+         << endl;
+    return nullptr;
+  }
+  if (header.version != rule_file_version) {
+    cerr << path << ": rule file version " << header.version << ", expected "
+         << rule_file_version << endl;
+    return nullptr;
+  }
+  file->num_rules = header.num_rules;
+  file->rules = reinterpret_cast<const Rule*>(file->data + sizeof(Header));
+
+  size_t n = file->file_size;
+  for (size_t i = 0; i < file->num_rules; i++) {
+    const Rule& rule = file->rules[i];
+    bool valid = valid_section<char>(rule.pattern, n)
+                 && valid_section<Instruction>(rule.code, n) && rule.code.size > 0
+                 && valid_section<ClassRecord>(rule.classes, n)
+                 && valid_section<char>(rule.class_bytes, n);
+    const ClassRecord* classes = file->section<ClassRecord>(rule.classes);
+    for (size_t c = 0; valid && c < rule.classes.size / sizeof(ClassRecord); c++) {
+      valid = uint64_t{classes[c].first_character} + classes[c].num_characters
+                  <= rule.class_bytes.size
+              && uint64_t{classes[c].first_range} + 2 * uint64_t{classes[c].num_ranges}
+                  <= rule.class_bytes.size;
+    }
+    for (int partial = 0; partial < 2 && valid && rule.has_dfa; partial++) {
+      const DfaRecord& dfa = rule.dfas[partial];
+      valid = valid_section<uint32_t>(dfa.next, n) && valid_section<uint8_t>(dfa.accepting, n)
+              && dfa.next.size == dfa.accepting.size * 256 * sizeof(uint32_t)
+              && valid_state(dfa.start, dfa.accepting.size)
+              && (dfa.stop == DenseDfa::no_stop_state
+                  || valid_state(dfa.stop, dfa.accepting.size));
+    }
+    if (!valid) {
+      cerr << path << ": rule " << i << " is corrupt" << endl;
+      return nullptr;
+    }
+  }
+  return file;
+}
+
+RuleFile::~RuleFile() {
+  if (data != nullptr) munmap(const_cast<char*>(data), file_size);
+}
+
+string RuleFile::pattern(size_t i) const {
+  return string(section<char>(rules[i].pattern), rules[i].pattern.size);
+}
+
+Program RuleFile::program(size_t i) const {
+  const Rule& rule = rules[i];
+  const Instruction* code = section<Instruction>(rule.code);
+  vector<Instruction> instructions(code, code + rule.code.size / sizeof(Instruction));
+
+  const ClassRecord* records = section<ClassRecord>(rule.classes);
+  const char* bytes = section<char>(rule.class_bytes);
+  vector<CharacterClass> classes;
+  for (size_t c = 0; c < rule.classes.size / sizeof(ClassRecord); c++) {
+    const ClassRecord& record = records[c];
+    CharacterClass cclass;
+    cclass.negated = record.negated;
+    cclass.characters.assign(bytes + record.first_character,
+                             bytes + record.first_character + record.num_characters);
+    for (size_t r = 0; r < record.num_ranges; r++) {
+      const char* range = bytes + record.first_range + 2 * r;
+      cclass.ranges.push_back({range[0], range[1]});
+    }
+    classes.push_back(move(cclass));
+  }
+  return Program(move(instructions), move(classes));
+}
+
+bool RuleFile::has_dfa(size_t i) const { return rules[i].has_dfa; }
+
+DenseDfa RuleFile::dfa(size_t i, bool partial) const {
+  assert(has_dfa(i));
+  const DfaRecord& record = rules[i].dfas[partial];
+  DenseDfa dfa;
+  dfa.next = section<uint32_t>(record.next);
+  dfa.accepting = section<uint8_t>(record.accepting);
+  dfa.rows = record.accepting.size;
+  dfa.storage = shared_from_this();
+  dfa.start = record.start;
+  dfa.stop = record.stop;
+  return dfa;
+}
+
+}  // namespace ure
@@ -0,0 +1,82 @@
+#ifndef RULE_FILE_H
+#define RULE_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "instruction.h"
+#include "ure_min_dfa.h"
+
+namespace ure {
+
+// Rule files hold patterns compiled ahead of time, so a process can start matching without
+// parsing them again. Each rule is a pattern, its program (see Parser::parse) and, when
+// they fit in max_dfa_states, its minimized DFAs (see ure_min_dfa.h).
+//
+// A file is a header, an array of fixed size rule records, and the rules' sections, each
+// aligned to 8 bytes. Records refer to sections by their offset from the start of the file,
+// so the file means the same wherever it's mapped. Integers and instructions are stored in
+// the host's native layout, with a byte order marker so files from hosts with a different
+// one are rejected rather than misread.
+//
+// Loading maps the file read-only and shared. DFA tables are used straight from the
+// mapping, with no copies, so opening a file costs a few page faults rather than time
+// proportional to its size, and processes loading the same file share its pages. Programs
+// are copied out as a block of instructions plus their character classes.
+//
+// Only the file's structure (its header, and that every section lies within the file) is
+// checked when it's opened, not the contents of the tables, so only load files written by
+// write_rule_file.
+
+// Incremented whenever the layout changes. Files with another version are rejected.
+const std::uint32_t rule_file_version = 1;
+
+// Parses each pattern and writes the results to path. Returns false, with a message on
+// stderr, if a pattern doesn't parse or the file can't be written.
+bool write_rule_file(const std::string& path, const std::vector<std::string>& patterns,
+                     std::size_t max_dfa_states = default_max_dfa_states);
+
+// A mapped rule file. The mapping stays alive as long as the RuleFile, or any DFA taken
+// from it, does.
+class RuleFile : public std::enable_shared_from_this<RuleFile> {
+ public:
+  // Maps the file at path. Returns nullptr, with a message on stderr, if it can't be read
+  // or isn't a valid rule file of rule_file_version.
+  static std::shared_ptr<const RuleFile> open(const std::string& path);
+  ~RuleFile();
+
+  std::size_t size() const { return num_rules; }
+  std::string pattern(std::size_t i) const;
+  Program program(std::size_t i) const;
+  // Whether the DFAs of rule i were built (they're left out if they'd have more than
+  // max_dfa_states states). If so, dfa() returns them, ready for UreMinDfa:
+  //
+  //   UreMinDfa re(file->dfa(i, false), file->dfa(i, true));
+  //
+  // Callers must check has_dfa(i) before calling dfa(i, ...), which asserts it: there's
+  // no DFA to return otherwise.
+  bool has_dfa(std::size_t i) const;
+  DenseDfa dfa(std::size_t i, bool partial) const;
+
+  // The layout of the file, see rule_file.cc.
+  struct Header;
+  struct Section;
+  struct Rule;
+
+ private:
+  RuleFile() {}
+  const char* data = nullptr;
+  std::size_t file_size = 0;
+  std::size_t num_rules = 0;
+  const Rule* rules = nullptr;
+
+  template <typename T>
+  const T* section(const Section& s) const;
+};
+
+}  // namespace ure
+
+#endif  // RULE_FILE_H
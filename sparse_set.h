@@ -0,0 +1,60 @@
+#ifndef SPARSE_SET_H
+#define SPARSE_SET_H
+
+#include <cstddef>
+#include <vector>
+
+namespace ure {
+
+// Set of integers in [0, capacity) with O(1) insert, membership test and clear, which
+// remembers insertion order. Used for NFA thread lists, where the set is cleared for every
+// byte of text.
+//
+// From Briggs and Torczon, "An Efficient Representation for Sparse Sets" (1993). dense
+// holds the members in insertion order, and sparse[i] is the index of i in dense if i is a
+// member. Neither array needs clearing: i is a member only if sparse[i] points into the
+// used part of dense at an entry equal to i, whatever stale values are lying around.
+class SparseSet {
+ public:
+  SparseSet() : used(0) {}
+
+  // Makes room for members up to capacity - 1. Never shrinks. Clears the set.
+  void reserve(std::size_t capacity) {
+    if (capacity > sparse.size()) {
+      sparse.resize(capacity);
+      dense.resize(capacity);
+    }
+    used = 0;
+  }
+
+  bool contains(std::size_t i) const {
+    std::size_t idx = sparse[i];
+    return idx < used && dense[idx] == i;
+  }
+
+  // Adds i to the set, returns false if it was already a member.
+  bool insert(std::size_t i) {
+    if (contains(i)) return false;
+    sparse[i] = used;
+    dense[used++] = i;
+    return true;
+  }
+
+  void clear() { used = 0; }
+  std::size_t size() const { return used; }
+  bool empty() const { return used == 0; }
+  std::size_t capacity() const { return sparse.size(); }
+
+  // Members in insertion order. Inserting while iterating by index is fine: new members
+  // are appended.
+  std::size_t operator[](std::size_t idx) const { return dense[idx]; }
+
+ private:
+  std::vector<std::size_t> dense;
+  std::vector<std::size_t> sparse;
+  std::size_t used;
+};
+
+}  // namespace ure
+
+#endif  // SPARSE_SET_H
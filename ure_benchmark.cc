@@ -0,0 +1,408 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "parser.h"
+#include "program_cache.h"
+#include "rule_file.h"
+#include "ure_bit_nfa.h"
+#include "ure_dfa.h"
+#include "ure_min_dfa.h"
+#include "ure_nfa.h"
+#include "ure_recursive.h"
+#include "ure_stl.h"
+
+using namespace ure;
+using namespace std;
+
+// Benchmarks for every engine, run with ./benchmark.sh. Results are written as JSON so runs
+// from different releases can be compared (e.g. with tools/compare.py from Google Benchmark).
+//
+// Throughput benchmarks take two arguments: the index of a case in corpus() and the text
+// size. Texts are built from near misses, so no engine can stop early and every byte is
+// scanned. full_match runs on the case's pattern surrounded by [^\x01]* (the texts never
+// contain \x01), so it also has to consume the whole text.
+
+// Log-like lines, about one in ten of which match log_pattern.
+const string log_pattern = "ERROR [a-z]+: .*timeout";
+
+vector<string> make_log_lines() {
+  vector<string> lines;
+  for (int i = 0; i < 200; i++) {
+    string level = i % 10 == 0 ? "ERROR" : "INFO";
+    lines.push_back("2023-01-01 12:00:" + to_string(i % 60) + " " + level
+                    + " server: request " + to_string(i) + " finished with timeout");
+  }
+  return lines;
+}
+
+struct Case {
+  string name;
+  string pattern;
+  // Repeated to fill the text. Must not contain a match of pattern, even when repeated.
+  string filler;
+};
+
+const vector<Case>& corpus() {
+  static const vector<Case> cases = {
+    {
+      "log_lines",
+      log_pattern,
+      // Contains the required literal "ERROR ", so the prefilter can't skip the text.
+      "2023-01-01 12:00:00 INFO server: request 17 finished with timeout\n"
+      "2023-01-01 12:00:01 ERROR server: request 18 finished ok\n",
+    },
+    {
+      "large_classes",
+      "[a-zA-Z0-9_.+-]+@[a-zA-Z0-9-]+\\.[a-zA-Z]+",
+      "contact someone@example or else, no-reply@host_name [at] dot com, v1.2 555-0199\n",
+    },
+    {
+      "long_alternation",
+      "(alpha|bravo|charlie|delta|echo|foxtrot|golf|hotel|india|juliett|kilo|lima|mike|"
+      "november|oscar|papa|quebec|romeo|sierra|tango|uniform|victor|whiskey|xray|yankee|"
+      "zulu)-[0-9]+",
+      "alphabet-x bravado-1 charlie- deltas echo_7 hotels kilogram-a zulus papa -42\n",
+    },
+  };
+  return cases;
+}
+
+string full_pattern(const Case& c) { return "[^\x01]*(" + c.pattern + ")[^\x01]*"; }
+
+// Builds the text for a case, keeping only the most recent one so that 100 MB texts for
+// different cases aren't all held at once.
+const string& text_for(size_t case_idx, size_t size) {
+  static size_t cached_case = SIZE_MAX;
+  static string cached_text;
+  if (case_idx != cached_case || cached_text.size() != size) {
+    const string& filler = corpus()[case_idx].filler;
+    cached_text.clear();
+    cached_text.reserve(size);
+    while (cached_text.size() < size) {
+      cached_text.append(filler, 0, size - cached_text.size());
+    }
+    cached_case = case_idx;
+  }
+  return cached_text;
+}
+
+// Whether re is ready to match. Engines with compile limits (see compile_error.h) get
+// their own overloads.
+template <typename Engine>
+bool compiled(const Engine& re) { return !re.parsing_failed(); }
+bool compiled(const UreMinDfa& re) { return !re.parsing_failed() && !re.compile_failed(); }
+bool compiled(const UreBitNfa& re) { return !re.parsing_failed() && !re.compile_failed(); }
+
+// UreStl recurses once per byte of text (and can take exponential time), and UreRecursive
+// refuses texts over its limit, so they're only run on small texts.
+template <typename Engine>
+size_t max_text_size() { return 100 << 20; }
+template <>
+size_t max_text_size<UreRecursive>() { return default_max_backtrack_text; }
+template <>
+size_t max_text_size<UreStl>() { return 4 << 10; }
+
+template <typename Engine>
+void text_sizes(benchmark::internal::Benchmark* b) {
+  for (size_t case_idx = 0; case_idx < corpus().size(); case_idx++) {
+    for (size_t size : {16, 256, 4 << 10, 64 << 10, 1 << 20, 16 << 20, 100 << 20}) {
+      if (size <= max_text_size<Engine>()) b->Args({int64_t(case_idx), int64_t(size)});
+    }
+  }
+}
+
+template <typename Engine>
+void BM_Construct(benchmark::State& state) {
+  const Case& c = corpus()[state.range(0)];
+  for (auto _ : state) {
+    Engine re(c.pattern);
+    benchmark::DoNotOptimize(re);
+  }
+  state.SetLabel(c.name);
+}
+
+template <typename Engine>
+void BM_FullMatch(benchmark::State& state) {
+  const Case& c = corpus()[state.range(0)];
+  const string& text = text_for(state.range(0), state.range(1));
+  Engine re(full_pattern(c));
+  if (!compiled(re)) {
+    state.SkipWithError("pattern not supported by this engine");
+    return;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(re.full_match(text));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+  state.SetLabel(c.name);
+}
+
+template <typename Engine>
+void BM_PartialMatch(benchmark::State& state) {
+  const Case& c = corpus()[state.range(0)];
+  const string& text = text_for(state.range(0), state.range(1));
+  Engine re(c.pattern);
+  if (!compiled(re)) {
+    state.SkipWithError("pattern not supported by this engine");
+    return;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(re.partial_match(text));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+  state.SetLabel(c.name);
+}
+
+// The pathological case from https://swtch.com/~rsc/regexp/regexp1.html: a?^n a^n against
+// a^n. Backtracking without memoization (UreStl) takes time exponential in n.
+template <typename Engine>
+void BM_Pathological(benchmark::State& state) {
+  size_t n = state.range(0);
+  string pattern;
+  for (size_t i = 0; i < n; i++) pattern += "a?";
+  pattern += string(n, 'a');
+  string text(n, 'a');
+  Engine re(pattern);
+  if (!compiled(re)) {
+    state.SkipWithError("pattern not supported by this engine");
+    return;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(re.full_match(text));
+  }
+}
+
+void corpus_cases(benchmark::internal::Benchmark* b) {
+  for (size_t case_idx = 0; case_idx < corpus().size(); case_idx++) {
+    b->Arg(case_idx);
+  }
+}
+
+#define URE_BENCHMARK_ENGINE(Engine, max_n)                                              \
+  BENCHMARK_TEMPLATE(BM_Construct, Engine)->Apply(corpus_cases);                         \
+  BENCHMARK_TEMPLATE(BM_FullMatch, Engine)->Apply(text_sizes<Engine>);                   \
+  BENCHMARK_TEMPLATE(BM_PartialMatch, Engine)->Apply(text_sizes<Engine>);                \
+  BENCHMARK_TEMPLATE(BM_Pathological, Engine)->RangeMultiplier(2)->Range(4, max_n)
+
+URE_BENCHMARK_ENGINE(UreNfa, 64);
+URE_BENCHMARK_ENGINE(UreDfa, 64);
+URE_BENCHMARK_ENGINE(UreMinDfa, 64);
+// The bit NFA only supports up to 64 positions, so n = 32 is as big as it gets.
+URE_BENCHMARK_ENGINE(UreBitNfa, 32);
+URE_BENCHMARK_ENGINE(UreRecursive, 64);
+URE_BENCHMARK_ENGINE(UreStl, 16);
+
+// One compiled UreNfa shared by every thread. Throughput should scale with the number of
+// threads, since matching only reads the shared program and each thread has its own
+// scratch space.
+static void BM_NfaSharedPartialMatch(benchmark::State& state) {
+  static const UreNfa re(log_pattern);
+  static const vector<string> lines = make_log_lines();
+  size_t i = state.thread_index();
+  size_t matches = 0;
+  for (auto _ : state) {
+    matches += re.partial_match(lines[i++ % lines.size()]);
+  }
+  benchmark::DoNotOptimize(matches);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_NfaSharedPartialMatch)->ThreadRange(1, 64)->UseRealTime();
+
+// Extracting the fields of a log line. The first pattern is one-pass, so full_match uses
+// the one-pass DFA; the extra alternative in the second makes it fall back to the Pike VM.
+static void BM_NfaSubmatches(benchmark::State& state) {
+  const string fields = "(\\d+)-(\\d+)-(\\d+) (\\d+):(\\d+):(\\d+) ([A-Z]+) (\\w+): (.*)";
+  const UreNfa re(state.range(0) == 0 ? fields : fields + "|x(y)x*x");
+  const string line = "2023-01-01 12:00:17 ERROR server: request 1234 finished with timeout";
+  vector<Submatch> groups;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(re.full_match(line, groups));
+  }
+  state.SetBytesProcessed(state.iterations() * line.size());
+  state.SetLabel(re.is_one_pass() ? "one-pass" : "pike-vm");
+}
+BENCHMARK(BM_NfaSubmatches)->Arg(0)->Arg(1);
+
+// full_match of one large text split across threads (the argument). Only faster than
+// BM_FullMatch<UreMinDfa> with more than one core, but shows the cost of running each chunk
+// from every state even without them.
+static void BM_MinDfaParallelFullMatch(benchmark::State& state) {
+  const Case& c = corpus()[0];
+  const string& text = text_for(0, 100 << 20);
+  const UreMinDfa re(full_pattern(c));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(re.parallel_full_match(text, state.range(0)));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+  state.SetLabel(c.name);
+}
+BENCHMARK(BM_MinDfaParallelFullMatch)->RangeMultiplier(2)->Range(1, 64)->UseRealTime();
+
+// Filtering a column of short strings stored Arrow-style (see batch.h). Arg 0 builds a
+// std::string for each row and calls partial_match through the Ure interface, arg 1 uses
+// match_batch.
+template <typename Engine>
+void BM_MatchBatch(benchmark::State& state) {
+  static const vector<string> lines = make_log_lines();
+  string data;
+  vector<int32_t> offsets = {0};
+  for (const string& line : lines) {
+    data += line;
+    offsets.push_back(data.size());
+  }
+  StringBatch batch = {data.data(), offsets.data(), lines.size()};
+  const Engine engine(log_pattern);
+  const Ure& re = engine;
+  vector<uint8_t> out(batch.size);
+  for (auto _ : state) {
+    if (state.range(0) == 0) {
+      for (size_t i = 0; i < batch.size; i++) {
+        out[i] = re.partial_match(string(batch.row_data(i), batch.row_size(i)));
+      }
+    } else {
+      engine.match_batch(batch, true, out);
+    }
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * batch.size);
+  state.SetLabel(state.range(0) == 0 ? "per-string" : "match_batch");
+}
+BENCHMARK_TEMPLATE(BM_MatchBatch, UreNfa)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_MatchBatch, UreMinDfa)->Arg(0)->Arg(1);
+
+// Building a UreNfa for a pattern seen before, from ProgramCache: a lookup instead of a
+// compile (compare BM_Construct<UreNfa>).
+static void BM_NfaCachedConstruct(benchmark::State& state) {
+  const Case& c = corpus()[state.range(0)];
+  ProgramCache::global().get(c.pattern);
+  for (auto _ : state) {
+    UreNfa re(ProgramCache::global().get(c.pattern));
+    benchmark::DoNotOptimize(re);
+  }
+  state.SetLabel(c.name);
+}
+BENCHMARK(BM_NfaCachedConstruct)->Apply(corpus_cases);
+
+// Tokenizing: every match of a word-or-number pattern in 1 MB of log lines.
+static void BM_NfaFindAll(benchmark::State& state) {
+  const UreNfa re("[a-zA-Z]+|[0-9]+");
+  const string& text = text_for(0, 1 << 20);
+  size_t start, end, tokens = 0;
+  for (auto _ : state) {
+    MatchIterator it = re.find_all(text);
+    while (it.next(start, end)) tokens++;
+  }
+  benchmark::DoNotOptimize(tokens);
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_NfaFindAll);
+
+// A pattern that ends in a literal but can start with almost any byte, against 1 MB of
+// paths with one match at the very end. UreNfa finds the suffix and confirms it with the
+// reversed program instead of running the NFA over every byte.
+static void BM_NfaSuffixSearch(benchmark::State& state) {
+  const UreNfa re("[a-zA-Z0-9_/-]+\\.json");
+  string text;
+  while (text.size() < (1 << 20)) text += "GET /api/v1/users/1234/profile.html 200\n";
+  text += "GET /api/v1/config.json 200\n";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(re.partial_match(text));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_NfaSuffixSearch);
+
+// Compiling generated patterns of 64 KB to 1 MB: an allow-list of words ("w0|w1|..."),
+// groups nested as deep as they go ("(((a)b)c)..."), and a long run of repeated items
+// ("a?b*c+..."). Parsing and code generation take time linear in the pattern's length,
+// so bytes_per_second should stay roughly flat as the size grows, dropping only as the
+// parser's working set outgrows the caches.
+string long_pattern(int shape, size_t size) {
+  string pattern;
+  if (shape == 0) {
+    for (size_t i = 0; pattern.size() < size; i++) {
+      pattern += "word" + to_string(i) + "|";
+    }
+    pattern.pop_back();
+  } else if (shape == 1) {
+    size_t depth = size / 3;
+    pattern.append(depth, '(');
+    pattern += 'a';
+    for (size_t i = 0; i < depth; i++) {
+      pattern += ')';
+      pattern += 'a' + i % 26;
+    }
+  } else {
+    for (size_t i = 0; pattern.size() < size; i++) {
+      pattern += 'a' + i % 26;
+      pattern += "?*+"[i % 3];
+    }
+  }
+  return pattern;
+}
+
+static void BM_ParseLongPattern(benchmark::State& state) {
+  const string pattern = long_pattern(state.range(0), state.range(1));
+  Parser parser;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(parser.parse(pattern));
+  }
+  state.SetBytesProcessed(state.iterations() * pattern.size());
+  state.SetLabel(vector<string>{"allow_list", "nested_groups", "repeated_items"}[state.range(0)]);
+}
+BENCHMARK(BM_ParseLongPattern)->ArgsProduct({{0, 1, 2}, {64 << 10, 256 << 10, 1 << 20}});
+
+// Startup with 200 rules: compiling each to a UreMinDfa, against loading them from a rule
+// file written beforehand (see rule_file.h).
+vector<string> rule_patterns() {
+  vector<string> patterns;
+  for (int i = 0; i < 200; i++) {
+    patterns.push_back("(ERROR|WARN) [a-z]+" + to_string(i) + ": .*(timeout|refused)");
+  }
+  return patterns;
+}
+
+static void BM_CompileRules(benchmark::State& state) {
+  const vector<string> patterns = rule_patterns();
+  for (auto _ : state) {
+    for (const string& pattern : patterns) {
+      UreMinDfa re(pattern);
+      benchmark::DoNotOptimize(re);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * patterns.size());
+}
+BENCHMARK(BM_CompileRules)->Unit(benchmark::kMillisecond);
+
+static void BM_LoadRuleFile(benchmark::State& state) {
+  const char* tmp = getenv("TMPDIR");
+  const string path = string(tmp != nullptr ? tmp : "/tmp") + "/ure_benchmark_rules";
+  if (!write_rule_file(path, rule_patterns())) {
+    state.SkipWithError("Can't write rule file");
+    return;
+  }
+  size_t num_rules = 0;
+  for (auto _ : state) {
+    shared_ptr<const RuleFile> file = RuleFile::open(path);
+    if (file == nullptr) {
+      state.SkipWithError("Can't open rule file");
+      return;
+    }
+    num_rules = file->size();
+    for (size_t i = 0; i < file->size(); i++) {
+      if (!file->has_dfa(i)) {
+        state.SkipWithError("Rule without DFAs");
+        return;
+      }
+      UreMinDfa re(file->dfa(i, false), file->dfa(i, true));
+      benchmark::DoNotOptimize(re);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_rules);
+}
+BENCHMARK(BM_LoadRuleFile)->Unit(benchmark::kMillisecond);
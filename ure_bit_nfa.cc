@@ -0,0 +1,147 @@
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "ure_bit_nfa.h"
+
+namespace ure {
+
+using namespace std;
+
+// Finds the positions reachable from pc by following Jump and Split instructions, and
+// whether the Match instruction is reachable the same way. positions maps each program
+// counter to its position number (or -1 if it isn't a consuming instruction).
+void position_closure(const Program& program, const vector<int>& positions,
+                      size_t pc, uint64_t& reached, bool& reaches_match) {
+  reached = 0;
+  reaches_match = false;
+  vector<bool> visited(program.size(), false);
+  vector<size_t> stack = {pc};
+  while (!stack.empty()) {
+    pc = stack.back();
+    stack.pop_back();
+    if (pc >= program.size() || visited[pc]) continue;
+    visited[pc] = true;
+
+    const Instruction& inst = program[pc];
+    switch (inst.type) {
+      case IType::Literal:  // fallthrough
+      case IType::Wildcard:  // fallthrough
+      case IType::Class:
+        reached |= uint64_t{1} << positions[pc];
+        break;
+      case IType::Jump:
+        stack.push_back(pc + inst.offset);
+        break;
+      case IType::Save:
+        stack.push_back(pc + 1);
+        break;
+      case IType::Split:
+        stack.push_back(pc + 1);
+        stack.push_back(pc + inst.offset);
+        break;
+      case IType::Match:
+        reaches_match = true;
+        break;
+      default:
+        cerr << "Unknown instruction type" << endl;
+        break;
+    }
+  }
+}
+
+UreBitNfa::UreBitNfa(const string& pattern)
+  : compiled(false), first(0), last(0), nullable(false), accepts(), follow_tables(),
+    num_tables(0) {
+  re = parser.parse(pattern);
+  if (re.empty()) return;
+
+  vector<int> positions(re.size(), -1);
+  vector<size_t> position_pcs;
+  for (size_t pc = 0; pc < re.size(); pc++) {
+    IType type = re[pc].type;
+    if (type == IType::Literal || type == IType::Wildcard || type == IType::Class) {
+      positions[pc] = position_pcs.size();
+      position_pcs.push_back(pc);
+    }
+  }
+  if (position_pcs.size() > max_bit_nfa_positions) {
+    compile_error = {
+      .pattern = pattern,
+      .msg = "Pattern has " + to_string(position_pcs.size()) + " consuming instructions, "
+             "at most " + to_string(max_bit_nfa_positions) + " are supported",
+    };
+    return;
+  }
+
+  position_closure(re, positions, 0, first, nullable);
+
+  vector<uint64_t> follow_sets(position_pcs.size());
+  for (size_t i = 0; i < position_pcs.size(); i++) {
+    size_t pc = position_pcs[i];
+    bool reaches_match;
+    position_closure(re, positions, pc + 1, follow_sets[i], reaches_match);
+    if (reaches_match) last |= uint64_t{1} << i;
+
+    const Instruction& inst = re[pc];
+    for (int c = 0; c < 256; c++) {
+      char ch = static_cast<char>(c);
+      bool match = inst.type == IType::Literal ? inst.c == ch
+                                                : re.byte_set(inst).contains(ch);
+      if (match) accepts[c] |= uint64_t{1} << i;
+    }
+  }
+
+  num_tables = (position_pcs.size() + 7) / 8;
+  for (size_t k = 0; k < num_tables; k++) {
+    for (int v = 1; v < 256; v++) {
+      // Build each entry from a smaller one: v without its lowest set bit.
+      int low_bit = __builtin_ctz(v);
+      size_t i = 8 * k + low_bit;
+      uint64_t follow_set = i < follow_sets.size() ? follow_sets[i] : 0;
+      follow_tables[k][v] = follow_tables[k][v & (v - 1)] | follow_set;
+    }
+  }
+  compiled = true;
+}
+
+uint64_t UreBitNfa::follow(uint64_t positions) const {
+  uint64_t next = 0;
+  for (size_t k = 0; k < num_tables; k++) {
+    next |= follow_tables[k][(positions >> (8 * k)) & 0xff];
+  }
+  return next;
+}
+
+bool UreBitNfa::full_match(const char* data, size_t size) const {
+  if (!compiled) return false;
+  if (size == 0) return nullable;
+
+  uint64_t positions = first & accepts[static_cast<unsigned char>(data[0])];
+  for (size_t idx = 1; idx < size && positions != 0; idx++) {
+    positions = follow(positions) & accepts[static_cast<unsigned char>(data[idx])];
+  }
+  return (positions & last) != 0;
+}
+
+bool UreBitNfa::partial_match(const char* data, size_t size) const {
+  if (!compiled) return false;
+  if (nullable) return true;
+
+  uint64_t positions = 0;
+  for (size_t idx = 0; idx < size; idx++) {
+    // A new thread can start at every position in the text.
+    positions = (follow(positions) | first) & accepts[static_cast<unsigned char>(data[idx])];
+    if (positions & last) return true;
+  }
+  return false;
+}
+
+bool UreBitNfa::parsing_failed() const { return re.empty(); }
+ParseError UreBitNfa::parser_error_info() { return parser.error_info(); }
+
+bool UreBitNfa::compile_failed() const { return !re.empty() && !compiled; }
+CompileError UreBitNfa::compile_error_info() const { return compile_error; }
+
+}  // namespace ure
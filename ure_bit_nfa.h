@@ -0,0 +1,70 @@
+#ifndef URE_BIT_NFA_H
+#define URE_BIT_NFA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "compile_error.h"
+#include "parser.h"
+#include "ure_interface.h"
+
+namespace ure {
+
+// Maximum number of consuming instructions (Literal, Wildcard, Class) UreBitNfa supports.
+const std::size_t max_bit_nfa_positions = 64;
+
+// Bit-parallel simulation of the NFA for patterns with at most 64 consuming instructions.
+//
+// Each consuming instruction is a "position" in the sense of Glushkov's construction, and
+// the set of live positions is held in a single uint64_t. Reading a byte c maps the set to
+// follow(set) & accepts[c], where follow(set) is the union of the positions that can come
+// next after each live position. follow() is computed from precomputed tables, one per
+// byte of the set, so a step costs at most eight table lookups and a few ALU operations,
+// independent of the number of live threads.
+//
+// Based on Navarro and Raffinot, "Compact DFA Representation for Fast Regular Expression
+// Search" (2001).
+//
+// Matching doesn't modify the object, so it's safe to share between threads.
+class UreBitNfa : public Ure {
+ public:
+  UreBitNfa(const std::string& pattern);
+  using Ure::full_match;
+  using Ure::partial_match;
+  bool full_match(const char* data, std::size_t size) const override;
+  bool partial_match(const char* data, std::size_t size) const override;
+
+  bool parsing_failed() const override;
+  ParseError parser_error_info();
+
+  // The pattern parsed, but has more than max_bit_nfa_positions consuming instructions.
+  // Matching always returns false in this case.
+  bool compile_failed() const;
+  CompileError compile_error_info() const;
+
+ private:
+  Program re;
+  Parser parser;
+  bool compiled;
+  CompileError compile_error;
+
+  // Positions reachable from the start of the program.
+  std::uint64_t first;
+  // Positions that can be followed by the Match instruction.
+  std::uint64_t last;
+  // The program can match the empty string.
+  bool nullable;
+  // accepts[c] is the set of positions which consume c.
+  std::uint64_t accepts[256];
+  // follow_tables[k][v] is the union of the follow sets of the positions 8k+i for each bit
+  // i set in v. Only the first num_tables tables are used.
+  std::uint64_t follow_tables[8][256];
+  std::size_t num_tables;
+
+  std::uint64_t follow(std::uint64_t positions) const;
+};
+
+}  // namespace ure
+
+#endif  // URE_BIT_NFA_H
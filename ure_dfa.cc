@@ -0,0 +1,42 @@
+#include <cstddef>
+
+#include "ure_dfa.h"
+
+namespace ure {
+
+using namespace std;
+
+UreDfa::UreDfa(const string& pattern, size_t max_cache_bytes) {
+  re = parser.parse(pattern);
+  if (!re.empty()) {
+    full_dfa = LazyDfa(re, max_cache_bytes);
+    partial_dfa = LazyDfa(re.unanchored(), max_cache_bytes);
+  }
+}
+
+bool match(LazyDfa& dfa, const char* data, size_t size, bool partial) {
+  int state = dfa.start_state();
+  for (size_t idx = 0; idx < size; idx++) {
+    if (partial && dfa.is_match(state)) return true;
+    state = dfa.next_state(state, data[idx]);
+    if (dfa.is_dead(state)) return false;
+  }
+  return dfa.is_match(state);
+}
+
+bool UreDfa::full_match(const char* data, size_t size) const {
+  return !re.empty() && match(full_dfa, data, size, false);
+}
+
+bool UreDfa::partial_match(const char* data, size_t size) const {
+  return !re.empty() && match(partial_dfa, data, size, true);
+}
+
+bool UreDfa::parsing_failed() const { return re.empty(); }
+ParseError UreDfa::parser_error_info() { return parser.error_info(); }
+
+size_t UreDfa::cache_flushes() const {
+  return full_dfa.num_flushes() + partial_dfa.num_flushes();
+}
+
+}  // namespace ure
@@ -0,0 +1,49 @@
+#ifndef URE_DFA_H
+#define URE_DFA_H
+
+#include <cstddef>
+#include <vector>
+
+#include "lazy_dfa.h"
+#include "parser.h"
+#include "ure_interface.h"
+
+namespace ure {
+
+// Default bound on the memory used by each of UreDfa's state caches.
+const std::size_t default_dfa_cache_bytes = 1 << 20;
+
+// Matches by walking a lazily-built DFA (see lazy_dfa.h), which caches the result of the
+// NFA simulation for each set of live program counters. After warm-up, matching costs one
+// table lookup per byte of text.
+//
+// max_cache_bytes bounds the memory used by the cached states. If a text needs more states
+// than fit, the cache is flushed and rebuilt as matching continues, so the result is
+// always correct but matching slows towards NFA speed.
+//
+// No attempt has been made to make this implementation thread-safe. Matching updates the
+// state cache even though the methods are const.
+class UreDfa : public Ure {
+ public:
+  UreDfa(const std::string& pattern, std::size_t max_cache_bytes = default_dfa_cache_bytes);
+  using Ure::full_match;
+  using Ure::partial_match;
+  bool full_match(const char* data, std::size_t size) const override;
+  bool partial_match(const char* data, std::size_t size) const override;
+
+  bool parsing_failed() const override;
+  ParseError parser_error_info();
+
+  // Total number of times the state caches have been flushed.
+  std::size_t cache_flushes() const;
+
+ private:
+  Program re;
+  Parser parser;
+  mutable LazyDfa full_dfa;
+  mutable LazyDfa partial_dfa;
+};
+
+}  // namespace ure
+
+#endif  // URE_DFA_H
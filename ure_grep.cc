@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ure_bit_nfa.h"
+#include "ure_dfa.h"
+#include "ure_min_dfa.h"
+#include "ure_nfa.h"
+#include "ure_recursive.h"
+
+using namespace ure;
+using namespace std;
+
+// Prints the lines of each file which contain a match of pattern, prefixed with their line
+// numbers (and file names, if there's more than one file):
+//
+//   ure_grep [-e engine] [-j threads] [-c] [--stats] pattern file...
+//
+//   -e         nfa (default), dfa, min_dfa, bit_nfa or recursive (with lines too long
+//              for it matched by nfa).
+//   -j         Number of threads, from 1 to 1024, by default one per core.
+//   -c         Only print the number of matching lines in each file.
+//   --stats    Print the time taken and throughput to stderr.
+//
+// Files are memory-mapped and split into chunks ending at newlines. Worker threads take
+// chunks in turn and match each of their lines. Results are collected per chunk, and
+// printed in order once the whole file has been searched.
+
+// Chunks are about this many bytes, so there are enough of them to balance the work
+// between threads, and few enough that the per-chunk overhead doesn't matter.
+const size_t chunk_bytes = 1 << 20;
+
+// Upper limit for -j, well past any useful number of threads.
+const size_t max_threads = 1024;
+
+struct Options {
+  string engine = "nfa";
+  size_t num_threads = 0;
+  bool count_only = false;
+  bool stats = false;
+  string pattern;
+  vector<string> files;
+};
+
+void usage() {
+  cerr << "Usage: ure_grep [-e nfa|dfa|min_dfa|bit_nfa|recursive] [-j threads] [-c] [--stats]"
+       << " pattern file..." << endl;
+}
+
+// Parses the argument of -j, which must be a number from 1 to max_threads.
+bool parse_num_threads(const char* arg, size_t& num_threads) {
+  char* end;
+  errno = 0;
+  unsigned long n = strtoul(arg, &end, 10);
+  if (!isdigit(static_cast<unsigned char>(arg[0])) || *end != '\0' || errno == ERANGE
+      || n < 1 || n > max_threads) {
+    cerr << "Invalid number of threads: " << arg << endl;
+    return false;
+  }
+  num_threads = n;
+  return true;
+}
+
+bool parse_args(int argc, char** argv, Options& options) {
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    string arg = argv[i];
+    if (arg == "-e" && i + 1 < argc) {
+      options.engine = argv[++i];
+    } else if (arg == "-j" && i + 1 < argc) {
+      if (!parse_num_threads(argv[++i], options.num_threads)) return false;
+    } else if (arg == "-c") {
+      options.count_only = true;
+    } else if (arg == "--stats") {
+      options.stats = true;
+    } else if (arg == "--") {
+      i++;
+      break;
+    } else {
+      return false;
+    }
+  }
+  if (i + 2 > argc) return false;
+  options.pattern = argv[i++];
+  for (; i < argc; i++) {
+    options.files.push_back(argv[i]);
+  }
+  if (options.num_threads == 0) options.num_threads = max(1u, thread::hardware_concurrency());
+  return true;
+}
+
+// UreRecursive, with lines too long for its bitmap (see UreRecursive::fits) matched by
+// UreNfa instead.
+class RecursiveWithFallback : public Ure {
+ public:
+  RecursiveWithFallback(const string& pattern) : recursive(pattern), nfa(pattern) {}
+  using Ure::full_match;
+  using Ure::partial_match;
+  bool full_match(const char* data, size_t size) const override {
+    return recursive.fits(size) ? recursive.full_match(data, size)
+                                : nfa.full_match(data, size);
+  }
+  bool partial_match(const char* data, size_t size) const override {
+    return recursive.fits(size) ? recursive.partial_match(data, size)
+                                : nfa.partial_match(data, size);
+  }
+  bool parsing_failed() const override { return recursive.parsing_failed(); }
+
+ private:
+  UreRecursive recursive;
+  UreNfa nfa;
+};
+
+// Builds an engine to match with. Returns nullptr if the engine can't handle the pattern.
+unique_ptr<Ure> make_engine(const string& engine, const string& pattern) {
+  unique_ptr<Ure> re;
+  if (engine == "nfa") {
+    re.reset(new UreNfa(pattern));
+  } else if (engine == "dfa") {
+    re.reset(new UreDfa(pattern));
+  } else if (engine == "min_dfa") {
+    UreMinDfa* min_dfa = new UreMinDfa(pattern);
+    re.reset(min_dfa);
+    if (min_dfa->compile_failed()) {
+      cerr << "min_dfa: " << min_dfa->compile_error_info().msg << endl;
+      return nullptr;
+    }
+  } else if (engine == "bit_nfa") {
+    UreBitNfa* bit_nfa = new UreBitNfa(pattern);
+    re.reset(bit_nfa);
+    if (bit_nfa->compile_failed()) {
+      cerr << "bit_nfa: " << bit_nfa->compile_error_info().msg << endl;
+      return nullptr;
+    }
+  } else if (engine == "recursive") {
+    re.reset(new RecursiveWithFallback(pattern));
+  } else {
+    cerr << "Unknown engine " << engine << endl;
+    return nullptr;
+  }
+  return re;
+}
+
+// A memory-mapped file, unmapped on destruction.
+class MappedFile {
+ public:
+  MappedFile(const string& path) : data(nullptr), size(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      cerr << path << ": " << strerror(errno) << endl;
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      cerr << path << ": " << strerror(errno) << endl;
+      close(fd);
+      return;
+    }
+    size = st.st_size;
+    if (size > 0) {
+      void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        cerr << path << ": " << strerror(errno) << endl;
+        size = 0;
+      } else {
+        data = static_cast<const char*>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+      }
+    }
+    close(fd);
+    ok = size == 0 || data != nullptr;
+  }
+  ~MappedFile() {
+    if (data != nullptr) munmap(const_cast<char*>(data), size);
+  }
+
+  const char* data;
+  size_t size;
+  bool ok = false;
+};
+
+// Results for one chunk of a file.
+struct ChunkResult {
+  size_t num_lines = 0;
+  // Line number within the chunk (from 0), offset in the file and length of each
+  // matching line.
+  struct Line {
+    size_t number;
+    size_t offset;
+    size_t size;
+  };
+  vector<Line> matches;
+  size_t num_matches = 0;
+};
+
+// Splits data into chunks of about chunk_bytes, each ending just after a newline (or at
+// the end of the data). Returns the offsets of the chunk boundaries, including 0 and size.
+vector<size_t> chunk_boundaries(const char* data, size_t size) {
+  vector<size_t> boundaries = {0};
+  while (boundaries.back() < size) {
+    size_t end = boundaries.back() + chunk_bytes;
+    if (end >= size) {
+      end = size;
+    } else {
+      const void* newline = memchr(data + end, '\n', size - end);
+      end = newline == nullptr ? size : static_cast<const char*>(newline) - data + 1;
+    }
+    boundaries.push_back(end);
+  }
+  return boundaries;
+}
+
+void search_chunk(const Ure& re, const char* data, size_t begin, size_t end,
+                  bool count_only, ChunkResult& result) {
+  size_t pos = begin;
+  while (pos < end) {
+    const void* newline = memchr(data + pos, '\n', end - pos);
+    size_t line_end = newline == nullptr ? end : static_cast<const char*>(newline) - data;
+    if (re.partial_match(data + pos, line_end - pos)) {
+      result.num_matches++;
+      if (!count_only) result.matches.push_back({result.num_lines, pos, line_end - pos});
+    }
+    result.num_lines++;
+    pos = line_end + 1;
+  }
+}
+
+// Searches one file, returning the number of matching lines, or -1 on error.
+long search_file(const Options& options, const vector<shared_ptr<const Ure>>& engines,
+                 const string& path, bool print_path, size_t& bytes_searched) {
+  MappedFile file(path);
+  if (!file.ok) return -1;
+  bytes_searched += file.size;
+
+  vector<size_t> boundaries = chunk_boundaries(file.data, file.size);
+  size_t num_chunks = boundaries.size() - 1;
+  vector<ChunkResult> results(num_chunks);
+  atomic<size_t> next_chunk(0);
+  vector<thread> workers;
+  for (size_t t = 0; t < engines.size(); t++) {
+    workers.emplace_back([&, t]() {
+      for (size_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+        search_chunk(*engines[t], file.data, boundaries[chunk], boundaries[chunk + 1],
+                     options.count_only, results[chunk]);
+      }
+    });
+  }
+  for (thread& worker : workers) {
+    worker.join();
+  }
+
+  long num_matches = 0;
+  size_t first_line = 1;
+  for (const ChunkResult& result : results) {
+    num_matches += result.num_matches;
+    for (const ChunkResult::Line& line : result.matches) {
+      if (print_path) cout << path << ":";
+      cout << first_line + line.number << ":";
+      cout.write(file.data + line.offset, line.size);
+      cout << '\n';
+    }
+    first_line += result.num_lines;
+  }
+  if (options.count_only) {
+    if (print_path) cout << path << ":";
+    cout << num_matches << '\n';
+  }
+  return num_matches;
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!parse_args(argc, argv, options)) {
+    usage();
+    return 2;
+  }
+
+  UreNfa check(options.pattern);
+  if (check.parsing_failed()) {
+    cerr << "Invalid pattern at position " << check.parser_error_info().idx << ": "
+         << options.pattern << endl;
+    return 2;
+  }
+  // The engine each worker thread matches with. All threads share one, except with UreDfa,
+  // whose cache is modified by matching, so every thread gets its own.
+  vector<shared_ptr<const Ure>> engines;
+  for (size_t t = 0; t < options.num_threads; t++) {
+    if (t > 0 && options.engine != "dfa") {
+      engines.push_back(engines[0]);
+      continue;
+    }
+    engines.push_back(make_engine(options.engine, options.pattern));
+    if (engines.back() == nullptr) return 2;
+  }
+
+  ios::sync_with_stdio(false);
+  auto start = chrono::steady_clock::now();
+  size_t bytes_searched = 0;
+  bool any_match = false, any_error = false;
+  for (const string& path : options.files) {
+    long num_matches = search_file(options, engines, path, options.files.size() > 1,
+                                   bytes_searched);
+    any_error = any_error || num_matches < 0;
+    any_match = any_match || num_matches > 0;
+  }
+  cout.flush();
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  if (options.stats) {
+    cerr << "Searched " << bytes_searched << " bytes in " << seconds << " s with "
+         << options.num_threads << " threads (" << options.engine << "): "
+         << bytes_searched / seconds / 1e9 << " GB/s" << endl;
+  }
+  // Like grep: 0 if a line matched, 1 if none did, 2 on errors.
+  if (any_error) return 2;
+  return any_match ? 0 : 1;
+}
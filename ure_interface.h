@@ -1,18 +1,30 @@
 #ifndef URE_INTERFACE_H
 #define URE_INTERFACE_H
 
+#include <cstddef>
 #include <string>
 
 namespace ure {
 
 // Interface loosely based on Sanjay Ghemawat's PCRE interface: http://man.he.net/man3/pcrecpp
+//
+// Engines implement matching on data[0, size), so a slice of a larger buffer can be matched
+// in place. The std::string overloads are shorthands for those. (Engines declaring their
+// own overloads of full_match or partial_match bring these back with using-declarations.)
 class Ure {
  public:
-  virtual bool full_match(const std::string& text) const = 0;
-  virtual bool partial_match(const std::string& text) const = 0;
+  virtual bool full_match(const char* data, std::size_t size) const = 0;
+  virtual bool partial_match(const char* data, std::size_t size) const = 0;
   virtual bool parsing_failed() const = 0;
+
+  bool full_match(const std::string& text) const {
+    return full_match(text.data(), text.size());
+  }
+  bool partial_match(const std::string& text) const {
+    return partial_match(text.data(), text.size());
+  }
 };
 
 }  // namespace ure
 
-#endif  // URE_INTERFACE_H
\ No newline at end of file
+#endif  // URE_INTERFACE_H
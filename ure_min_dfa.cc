@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "batch.h"
+#include "lazy_dfa.h"
+#include "ure_min_dfa.h"
+
+namespace ure {
+
+using namespace std;
+
+constexpr uint32_t DenseDfa::no_stop_state;
+
+// Explores every state reachable from the start state of program, giving a complete
+// transition table in terms of state indices (rather than row offsets). State 0 is the
+// start state. Returns false if there are more than max_states states.
+bool subset_construction(const Program& program, bool partial, size_t max_states,
+                         vector<uint32_t>& table, vector<bool>& accepting) {
+  // The lazy DFA never flushes with an unbounded cache, so its state ids are stable and
+  // numbered in the order the states were discovered.
+  LazyDfa lazy(program, numeric_limits<size_t>::max());
+  lazy.start_state();
+  for (size_t state = 0; state < lazy.num_states(); state++) {
+    bool absorbing = partial && lazy.is_match(state);
+    for (int c = 0; c < 256; c++) {
+      uint32_t next = absorbing ? state : lazy.next_state(state, static_cast<char>(c));
+      if (lazy.num_states() > max_states) return false;
+      table.push_back(next);
+    }
+    accepting.push_back(lazy.is_match(state));
+  }
+  return true;
+}
+
+// Hopcroft's partition refinement algorithm. Returns the block (minimized state) of each
+// state. Bytes that no state can tell apart are grouped first, so the refinement loop
+// runs over the (usually much smaller) set of byte classes rather than all 256 bytes.
+vector<uint32_t> minimize(const vector<uint32_t>& table, const vector<bool>& accepting) {
+  size_t n = accepting.size();
+
+  // Byte classes: bytes whose column in the transition table is identical.
+  map<vector<uint32_t>, int> column_ids;
+  vector<int> representatives;
+  for (int c = 0; c < 256; c++) {
+    vector<uint32_t> column(n);
+    for (size_t s = 0; s < n; s++) {
+      column[s] = table[s * 256 + c];
+    }
+    if (column_ids.emplace(move(column), representatives.size()).second) {
+      representatives.push_back(c);
+    }
+  }
+
+  // Inverse transitions for each byte class: sources[k][t] lists the states that move to t
+  // on the representative byte of class k.
+  size_t num_classes = representatives.size();
+  vector<vector<vector<uint32_t>>> sources(num_classes, vector<vector<uint32_t>>(n));
+  for (size_t k = 0; k < num_classes; k++) {
+    for (size_t s = 0; s < n; s++) {
+      sources[k][table[s * 256 + representatives[k]]].push_back(s);
+    }
+  }
+
+  // Initial partition: accepting and non-accepting states.
+  vector<vector<uint32_t>> blocks;
+  vector<uint32_t> block_of(n);
+  for (bool accept : {false, true}) {
+    vector<uint32_t> block;
+    for (size_t s = 0; s < n; s++) {
+      if (accepting[s] == accept) {
+        block_of[s] = blocks.size();
+        block.push_back(s);
+      }
+    }
+    if (!block.empty()) blocks.push_back(move(block));
+  }
+
+  // Every block is used as a splitter, for every byte class, at least once.
+  vector<uint32_t> worklist;
+  vector<bool> in_worklist(blocks.size(), true);
+  for (size_t b = 0; b < blocks.size(); b++) {
+    worklist.push_back(b);
+  }
+
+  vector<uint32_t> marked_count;
+  vector<bool> marked(n, false);
+  vector<uint32_t> touched_blocks;
+  while (!worklist.empty()) {
+    uint32_t splitter = worklist.back();
+    worklist.pop_back();
+    in_worklist[splitter] = false;
+    // Copied since splitting below can modify the splitter block itself.
+    vector<uint32_t> splitter_states = blocks[splitter];
+
+    for (size_t k = 0; k < num_classes; k++) {
+      // Mark the states that move into the splitter on this byte class.
+      marked_count.resize(blocks.size(), 0);
+      for (uint32_t t : splitter_states) {
+        for (uint32_t s : sources[k][t]) {
+          if (marked[s]) continue;
+          marked[s] = true;
+          if (marked_count[block_of[s]]++ == 0) touched_blocks.push_back(block_of[s]);
+        }
+      }
+
+      // Split each block that is only partly marked.
+      for (uint32_t b : touched_blocks) {
+        if (marked_count[b] < blocks[b].size()) {
+          vector<uint32_t> in, out;
+          for (uint32_t s : blocks[b]) {
+            (marked[s] ? in : out).push_back(s);
+          }
+          uint32_t new_block = blocks.size();
+          // Keep the larger half in place and move the smaller one to the new block.
+          if (in.size() > out.size()) swap(in, out);
+          for (uint32_t s : in) {
+            block_of[s] = new_block;
+          }
+          blocks[b] = move(out);
+          blocks.push_back(move(in));
+          in_worklist.push_back(false);
+          marked_count.push_back(0);
+          // If b is still waiting to be used as a splitter, both halves need to be.
+          // Otherwise splitting by either half is enough, and using only the smaller one
+          // is what makes Hopcroft's algorithm O(n log n). Either way, that means adding
+          // the new block.
+          worklist.push_back(new_block);
+          in_worklist[new_block] = true;
+        }
+        marked_count[b] = 0;
+      }
+      touched_blocks.clear();
+      for (uint32_t t : splitter_states) {
+        for (uint32_t s : sources[k][t]) {
+          marked[s] = false;
+        }
+      }
+    }
+  }
+
+  return block_of;
+}
+
+bool build_dense_dfa(const Program& program, bool partial, size_t max_states,
+                     DenseDfa& dfa) {
+  vector<uint32_t> table;
+  vector<bool> accepting;
+  if (!subset_construction(program, partial, max_states, table, accepting)) return false;
+  vector<uint32_t> block_of = minimize(table, accepting);
+
+  // Renumber blocks in order of first appearance, so the start state (state 0) stays at 0.
+  size_t n = accepting.size();
+  vector<uint32_t> renumbered(n, numeric_limits<uint32_t>::max());
+  vector<uint32_t> representatives;
+  for (size_t s = 0; s < n; s++) {
+    uint32_t& id = renumbered[block_of[s]];
+    if (id == numeric_limits<uint32_t>::max()) {
+      id = representatives.size();
+      representatives.push_back(s);
+    }
+  }
+
+  // The tables, kept alive by the DFA's storage.
+  struct Tables {
+    vector<uint32_t> next;
+    vector<uint8_t> accepting;
+  };
+  shared_ptr<Tables> tables = make_shared<Tables>();
+  tables->accepting.resize(representatives.size());
+  tables->next.resize(representatives.size() * 256);
+  DenseDfa result;
+  for (size_t i = 0; i < representatives.size(); i++) {
+    uint32_t s = representatives[i];
+    tables->accepting[i] = accepting[s];
+    bool absorbing = true;
+    for (int c = 0; c < 256; c++) {
+      uint32_t next = renumbered[block_of[table[s * 256 + c]]];
+      tables->next[i * 256 + c] = next * 256;
+      absorbing = absorbing && next == i;
+    }
+    if (absorbing && accepting[s] == partial) {
+      result.stop = i * 256;
+    }
+  }
+  result.next = tables->next.data();
+  result.accepting = tables->accepting.data();
+  result.rows = representatives.size();
+  result.storage = move(tables);
+  result.start = 0;
+  dfa = move(result);
+  return true;
+}
+
+UreMinDfa::UreMinDfa(const string& pattern, size_t max_states) : compiled(false) {
+  re = parser.parse(pattern);
+  if (re.empty()) return;
+
+  compiled = build_dense_dfa(re, false, max_states, full_dfa)
+             && build_dense_dfa(re.unanchored(), true, max_states, partial_dfa);
+  if (!compiled) {
+    compile_error = {
+      .pattern = pattern,
+      .msg = "DFA would need more than " + to_string(max_states) + " states",
+    };
+  }
+}
+
+UreMinDfa::UreMinDfa(DenseDfa full_dfa, DenseDfa partial_dfa)
+  : full_dfa(move(full_dfa)), partial_dfa(move(partial_dfa)), compiled(true) {}
+
+// Runs dfa over data[0, size) from state, returning the state reached.
+uint32_t run(const DenseDfa& dfa, uint32_t state, const char* data, size_t size) {
+  const uint32_t* next = dfa.next;
+  for (size_t idx = 0; idx < size && state != dfa.stop; idx++) {
+    state = next[state + static_cast<unsigned char>(data[idx])];
+  }
+  return state;
+}
+
+bool match(const DenseDfa& dfa, const char* data, size_t size) {
+  return dfa.is_accepting(run(dfa, dfa.start, data, size));
+}
+
+bool UreMinDfa::full_match(const char* data, size_t size) const {
+  return compiled && match(full_dfa, data, size);
+}
+
+bool UreMinDfa::partial_match(const char* data, size_t size) const {
+  return compiled && match(partial_dfa, data, size);
+}
+
+// Number of bytes run between checks for runs that have merged in run_all_states.
+const size_t merge_interval = 256;
+
+// Runs dfa over data[0, size) from every state, setting end_states[row] to the state
+// reached from state row * 256.
+void run_all_states(const DenseDfa& dfa, const char* data, size_t size,
+                    vector<uint32_t>& end_states) {
+  size_t n = dfa.num_states();
+  // The distinct states the runs are in, and which of them each run is in.
+  vector<uint32_t> current(n), run_of(n);
+  for (size_t row = 0; row < n; row++) {
+    current[row] = row * 256;
+    run_of[row] = row;
+  }
+  vector<uint32_t> merged_into(n, numeric_limits<uint32_t>::max());
+  vector<uint32_t> remap, merged;
+  for (size_t pos = 0; pos < size; pos += merge_interval) {
+    if (current.size() == 1) {
+      current[0] = run(dfa, current[0], data + pos, size - pos);
+      break;
+    }
+    // Runs advance a byte at a time together, so their table lookups are independent
+    // and can overlap instead of each waiting on the previous one.
+    const uint32_t* next = dfa.next;
+    size_t end = min(pos + merge_interval, size);
+    for (size_t idx = pos; idx < end; idx++) {
+      unsigned char c = data[idx];
+      for (uint32_t& state : current) {
+        state = next[state + c];
+      }
+    }
+
+    remap.resize(current.size());
+    merged.clear();
+    for (size_t i = 0; i < current.size(); i++) {
+      uint32_t& id = merged_into[current[i] / 256];
+      if (id == numeric_limits<uint32_t>::max()) {
+        id = merged.size();
+        merged.push_back(current[i]);
+      }
+      remap[i] = id;
+    }
+    for (uint32_t state : current) {
+      merged_into[state / 256] = numeric_limits<uint32_t>::max();
+    }
+    if (merged.size() < current.size()) {
+      for (uint32_t& i : run_of) {
+        i = remap[i];
+      }
+      current.swap(merged);
+    }
+  }
+
+  end_states.resize(n);
+  for (size_t row = 0; row < n; row++) {
+    end_states[row] = current[run_of[row]];
+  }
+}
+
+bool UreMinDfa::parallel_full_match(const char* data, size_t size,
+                                    size_t num_threads) const {
+  if (!compiled) return false;
+  size_t num_chunks = max<size_t>(1, min(num_threads, size));
+  size_t chunk_size = size / num_chunks;
+  auto chunk_begin = [&](size_t chunk) {
+    return chunk == num_chunks ? size : chunk * chunk_size;
+  };
+
+  // The first chunk's start state is known, so it's run normally.
+  uint32_t state = full_dfa.start;
+  vector<vector<uint32_t>> end_states(num_chunks);
+  for_each_range(num_chunks, num_chunks, [&](size_t begin, size_t end) {
+    for (size_t chunk = begin; chunk < end; chunk++) {
+      const char* chunk_data = data + chunk_begin(chunk);
+      size_t chunk_size = chunk_begin(chunk + 1) - chunk_begin(chunk);
+      if (chunk == 0) {
+        state = run(full_dfa, state, chunk_data, chunk_size);
+      } else {
+        run_all_states(full_dfa, chunk_data, chunk_size, end_states[chunk]);
+      }
+    }
+  });
+  for (size_t chunk = 1; chunk < num_chunks; chunk++) {
+    state = end_states[chunk][state / 256];
+  }
+  return full_dfa.is_accepting(state);
+}
+
+bool UreMinDfa::parallel_full_match(const string& text, size_t num_threads) const {
+  return parallel_full_match(text.data(), text.size(), num_threads);
+}
+
+void UreMinDfa::match_batch(const StringBatch& batch, bool partial, vector<uint8_t>& out,
+                            size_t num_threads) const {
+  out.assign(batch.size, 0);
+  if (!compiled) return;
+  const DenseDfa& dfa = partial ? partial_dfa : full_dfa;
+  for_each_range(batch.size, num_threads, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      out[i] = match(dfa, batch.row_data(i), batch.row_size(i));
+    }
+  });
+}
+
+void write_stream_state(uint32_t dfa_state, bool partial, uint8_t* state) {
+  for (int i = 0; i < 4; i++) {
+    state[i] = dfa_state >> (8 * i);
+  }
+  state[4] = partial;
+  state[5] = state[6] = state[7] = 0;
+}
+
+// Reads the DFA state saved in state, which must be one of dfa's.
+uint32_t read_stream_state(const DenseDfa& dfa, const uint8_t* state) {
+  uint32_t dfa_state = 0;
+  for (int i = 0; i < 4; i++) {
+    dfa_state |= uint32_t{state[i]} << (8 * i);
+  }
+  assert(state[4] <= 1 && dfa_state % 256 == 0 && dfa_state / 256 < dfa.num_states());
+  return dfa_state;
+}
+
+void UreMinDfa::begin(uint8_t* state, bool partial) const {
+  write_stream_state(partial ? partial_dfa.start : full_dfa.start, partial, state);
+}
+
+void UreMinDfa::feed(uint8_t* state, const char* data, size_t size) const {
+  if (!compiled) return;
+  bool partial = state[4];
+  const DenseDfa& dfa = partial ? partial_dfa : full_dfa;
+  write_stream_state(run(dfa, read_stream_state(dfa, state), data, size), partial, state);
+}
+
+bool UreMinDfa::finish(const uint8_t* state) const {
+  if (!compiled) return false;
+  const DenseDfa& dfa = state[4] ? partial_dfa : full_dfa;
+  return dfa.is_accepting(read_stream_state(dfa, state));
+}
+
+// Only DFAs built from a pattern have a program.
+bool UreMinDfa::parsing_failed() const { return re.empty() && !compiled; }
+ParseError UreMinDfa::parser_error_info() { return parser.error_info(); }
+
+bool UreMinDfa::compile_failed() const { return !re.empty() && !compiled; }
+CompileError UreMinDfa::compile_error_info() const { return compile_error; }
+
+size_t UreMinDfa::num_states(bool partial) const {
+  return partial ? partial_dfa.num_states() : full_dfa.num_states();
+}
+
+}  // namespace ure
@@ -0,0 +1,118 @@
+#ifndef URE_MIN_DFA_H
+#define URE_MIN_DFA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "batch.h"
+#include "compile_error.h"
+#include "parser.h"
+#include "ure_interface.h"
+
+namespace ure {
+
+// Default limit on the number of states UreMinDfa will build for each of its automata.
+const std::size_t default_max_dfa_states = 4096;
+
+// Size in bytes of UreMinDfa's stream state (see UreMinDfa::begin).
+const std::size_t min_dfa_stream_state_size = 8;
+
+// A DFA stored as a dense state x byte transition table.
+//
+// The tables are immutable and reference counted, so copies are cheap and share them. They
+// may also live in memory the DFA doesn't own, such as a mapped file (see rule_file.h), in
+// which case storage keeps that memory alive.
+struct DenseDfa {
+  // States are identified by the offset of their row in next, i.e. state i is i * 256, so
+  // the state reached from state on c is next[state + (unsigned char) c].
+  const std::uint32_t* next = nullptr;
+  // Indexed by row (state / 256), 1 for accepting states and 0 for the others.
+  const std::uint8_t* accepting = nullptr;
+  std::size_t rows = 0;
+  std::shared_ptr<const void> storage;
+  std::uint32_t start = 0;
+  // An absorbing state at which matching can stop early: the dead state for full matches,
+  // or the accepting state for partial matches (see build_dense_dfa). no_stop_state if
+  // there isn't one.
+  std::uint32_t stop = no_stop_state;
+
+  static constexpr std::uint32_t no_stop_state = UINT32_MAX;
+
+  std::size_t num_states() const { return rows; }
+  bool is_accepting(std::uint32_t state) const { return accepting[state / 256]; }
+};
+
+// Builds a minimal DFA for program by subset construction followed by Hopcroft's
+// minimization algorithm. If partial is set, accepting states are made absorbing, since a
+// partial match is decided as soon as any Match instruction is reached.
+//
+// Returns false without modifying dfa if the subset construction would need more than
+// max_states states.
+bool build_dense_dfa(const Program& program, bool partial,
+                     std::size_t max_states, DenseDfa& dfa);
+
+// Matches with a DFA that's fully built and minimized when the pattern is compiled, so
+// matching is a single table lookup per byte of text with no cache to check or fill.
+// Construction is expensive (and can fail, see compile_failed()), so this is meant for
+// patterns that are compiled once and matched many times.
+//
+// Matching doesn't modify the object, so it's safe to share between threads.
+class UreMinDfa : public Ure {
+ public:
+  UreMinDfa(const std::string& pattern, std::size_t max_states = default_max_dfa_states);
+  // Matches with DFAs built beforehand by build_dense_dfa, e.g. loaded from a rule file
+  // (see rule_file.h): full_dfa from the pattern's program, and partial_dfa from the
+  // unanchored program with partial set.
+  UreMinDfa(DenseDfa full_dfa, DenseDfa partial_dfa);
+  using Ure::full_match;
+  using Ure::partial_match;
+  bool full_match(const char* data, std::size_t size) const override;
+  bool partial_match(const char* data, std::size_t size) const override;
+
+  bool parsing_failed() const override;
+  ParseError parser_error_info();
+
+  // The pattern parsed, but one of the DFAs would have needed more than max_states states.
+  // Matching always returns false in this case.
+  bool compile_failed() const;
+  CompileError compile_error_info() const;
+
+  std::size_t num_states(bool partial) const;
+
+  // Same result as full_match(text), but splits text into num_threads chunks matched on
+  // separate threads. The state each chunk starts in isn't known until the previous chunks
+  // are done, so every chunk after the first is run from all states at once, giving a map
+  // from start state to end state. Composing the maps in order gives the final state.
+  //
+  // Running from every state costs more per byte than running from one, but the runs
+  // usually converge to a few distinct states within a few bytes, and runs that reach the
+  // same state are merged. Worth it for texts of megabytes or more.
+  bool parallel_full_match(const char* data, std::size_t size, std::size_t num_threads) const;
+  bool parallel_full_match(const std::string& text, std::size_t num_threads) const;
+
+  // Batch matching, as in UreNfa (see ure_nfa.h).
+  void match_batch(const StringBatch& batch, bool partial, std::vector<std::uint8_t>& out,
+                   std::size_t num_threads = 1) const;
+
+  // Streaming, as in UreNfa (see ure_nfa.h), but the state is always
+  // min_dfa_stream_state_size bytes: the current DFA state, stored little-endian, and
+  // which of the two DFAs it belongs to. As with UreNfa, a blob is only valid for the same
+  // compiled pattern (debug builds assert that its state is one of the DFA's).
+  void begin(std::uint8_t* state, bool partial) const;
+  void feed(std::uint8_t* state, const char* data, std::size_t size) const;
+  bool finish(const std::uint8_t* state) const;
+
+ private:
+  Program re;
+  Parser parser;
+  DenseDfa full_dfa;
+  DenseDfa partial_dfa;
+  bool compiled;
+  CompileError compile_error;
+};
+
+}  // namespace ure
+
+#endif  // URE_MIN_DFA_H
@@ -1,116 +1,629 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
-#include <set>
+#include <memory>
+#include <utility>
 
+#include "prefilter.h"
 #include "ure_nfa.h"
 
 namespace ure {
 
 using namespace std;
 
-UreNfa::UreNfa(const string& pattern) {
-  re = parser.parse(pattern);
-  if (!re.empty()) {
-    partial_re = Instruction::match_all;
-    for (const Instruction& inst : re) {
-      partial_re.push_back(inst);
+// Bytes a match can start with, above which skipping ahead to the first of them is
+// assumed to skip too little to beat the reverse suffix search.
+const size_t max_skip_bytes = 32;
+
+shared_ptr<const NfaProgram> compile_nfa(const string& pattern) {
+  shared_ptr<NfaProgram> compiled = make_shared<NfaProgram>();
+  Parser parser;
+  compiled->re = parser.parse(pattern);
+  compiled->error = parser.error_info();
+  if (!compiled->re.empty()) {
+    compiled->partial_re = compiled->re.unanchored();
+    compiled->literal = required_literal(compiled->re);
+    compiled->can_skip = first_bytes(compiled->re, compiled->first_bytes);
+    compiled->capture_re = parser.parse(pattern, true);
+    for (const Instruction& inst : compiled->capture_re) {
+      if (inst.type == IType::Save) {
+        compiled->num_groups = max<size_t>(compiled->num_groups, inst.slot / 2);
+      }
     }
+    compiled->is_one_pass = build_one_pass(compiled->capture_re, compiled->one_pass);
+    compiled->reverse_re = parser.parse(pattern, false, true);
+    compiled->suffix = literal_prefix(compiled->reverse_re);
+    reverse(compiled->suffix.begin(), compiled->suffix.end());
+    // Without a suffix there's nothing to search for, and if skipping to the first bytes of
+    // a match skips most of the text, scanning forwards is as good.
+    compiled->use_reverse_suffix = !compiled->suffix.empty()
+        && (!compiled->can_skip || compiled->first_bytes.count() > max_skip_bytes);
   }
+  return compiled;
 }
 
-struct Thread {
-  size_t pc;
+UreNfa::UreNfa(const string& pattern) : program(compile_nfa(pattern)) {}
 
-  Thread(size_t pc) : pc(pc) {}
-};
+UreNfa::UreNfa(shared_ptr<const NfaProgram> program) : program(move(program)) {}
 
-struct ThreadList {
-  ThreadList(size_t program_size) : used(program_size, false) {
-    threads.reserve(program_size);
-  };
+// Scratch space for the overloads of full_match and partial_match without a scratch
+// argument.
+thread_local NfaScratch thread_scratch;
 
-  void add(size_t pc) {
-    if (used[pc]) return;
-    threads.emplace_back(pc);
-    used[pc] = true;
+// Runs all the threads of the NFA in lockstep over the text, one position at a time. Each
+// thread is just a program counter, so the thread lists are sets of program counters:
+// threads reaching the same instruction at the same position would behave identically
+// from then on, so only the first is kept.
+//
+// Starts from the threads in scratch.threads, and runs them over data[0, size), which is
+// the end of the text if end_of_text is set, or a chunk of it otherwise (see feed()).
+// Returns true as soon as a match is found. Otherwise, leaves the threads alive after the
+// last byte in scratch.threads, so a later call can continue from there.
+//
+// For partial matches, program must be unanchored (see Program::unanchored), and skip may
+// give the bytes a match can start with (see first_bytes in prefilter.h). Then whenever
+// the only thread left is the match_all loop, no match is in progress, and the search
+// jumps straight to the next byte in skip.
+//
+// If reverse is set, the text is read backwards, from data[size - 1] to data[0], as
+// needed for reversed programs (see Parser::parse), and skip must be null. If bytes_read
+// isn't null, it's set to the number of bytes read before stopping.
+template <bool reverse = false>
+bool run_threads(const Program& program, const char* data, size_t size, bool end_of_text,
+                 NfaScratch& scratch, bool partial, const ByteSet* skip,
+                 size_t* bytes_read = nullptr) {
+  SparseSet* threads = &scratch.threads;
+  SparseSet* next_threads = &scratch.next_threads;
+  size_t end = end_of_text ? size + 1 : size;
+  bool matched = false;
+  size_t idx = 0;
+  for (; idx < end && !threads->empty() && !matched; idx++) {
+    if (skip != nullptr && threads->size() == 1) {
+      idx += find_first_in(*skip, data + idx, size - idx);
+      if (idx == size) break;
+    }
+    next_threads->clear();
+    char c = idx < size ? data[reverse ? size - 1 - idx : idx] : 0;
+    // Jump and Split add threads to the current list, so threads->size() grows as we go.
+    for (size_t t = 0; t < threads->size() && !matched; t++) {
+      size_t pc = (*threads)[t];
+      if (pc >= program.size()) {
+        cerr << "Invalid program counter " << pc
+             << ", program.size() is " << program.size() << endl;
+        next_threads->clear();
+        break;
+      }
+
+      const Instruction& inst = program[pc];
+      switch (inst.type) {
+        case IType::Literal:
+          if (idx < size && inst.c == c) {
+            next_threads->insert(pc+1);
+          }
+          break;
+        case IType::Wildcard:  // fallthrough
+        case IType::Class:
+          if (idx < size && program.byte_set(inst).contains(c)) {
+            next_threads->insert(pc+1);
+          }
+          break;
+        case IType::Jump:
+          threads->insert(pc + inst.offset);
+          break;
+        case IType::Save:
+          threads->insert(pc+1);
+          break;
+        case IType::Split:
+          threads->insert(pc+1);
+          threads->insert(pc + inst.offset);
+          break;
+        case IType::Match:
+          matched = partial || (end_of_text && idx == size);
+          break;
+        default:
+          cerr << "Unknown instruction type" << endl;
+          next_threads->clear();
+          t = threads->size();
+          break;
+      }
+    }
+    swap(threads, next_threads);
+  }
+  if (threads != &scratch.threads) swap(scratch.threads, scratch.next_threads);
+  if (bytes_read != nullptr) *bytes_read = min(idx, size);
+  return matched;
+}
+
+template <bool reverse = false>
+bool match(const Program& program, const char* data, size_t size, NfaScratch& scratch,
+           bool partial = false, const ByteSet* skip = nullptr, size_t* bytes_read = nullptr) {
+  if (program.empty()) return false;
+  scratch.threads.reserve(program.size());
+  scratch.next_threads.reserve(program.size());
+  scratch.threads.insert(0);
+  return run_threads<reverse>(program, data, size, true, scratch, partial, skip, bytes_read);
+}
+
+// Partial matching for patterns whose matches all end with compiled.suffix: every
+// occurrence of the suffix is a place a match could end, so reverse_re is run backwards
+// from there to see if one does, stopping at the first that matches.
+//
+// Occurrences close together can make the backward runs read the same bytes over and
+// over, so once they've read more than max_reverse_scan_factor times the size of the text,
+// sets gave_up instead, and the caller should search forwards.
+const size_t max_reverse_scan_factor = 4;
+
+bool reverse_suffix_match(const NfaProgram& compiled, const char* data, size_t size,
+                          NfaScratch& scratch, bool& gave_up) {
+  const string& suffix = compiled.suffix;
+  size_t budget = max_reverse_scan_factor * size;
+  size_t pos = 0;
+  while (pos < size) {
+    const char* found = static_cast<const char*>(
+        memmem(data + pos, size - pos, suffix.data(), suffix.size()));
+    if (found == nullptr) return false;
+    size_t end = found - data + suffix.size();
+    size_t bytes_read;
+    if (match<true>(compiled.reverse_re, data, end, scratch, true, nullptr, &bytes_read)) {
+      return true;
+    }
+    if (bytes_read > budget) {
+      gave_up = true;
+      return false;
+    }
+    budget -= bytes_read;
+    pos = found - data + 1;
   }
+  return false;
+}
 
-  size_t size() const {
-    return threads.size();
+// Whether data[0, size) ends with suffix, which every full match must.
+bool ends_with(const char* data, size_t size, const string& suffix) {
+  return size >= suffix.size() && memcmp(data + size - suffix.size(), suffix.data(),
+                                         suffix.size()) == 0;
+}
+
+// Capture arrays are reference counted, so that threads can share them until one of them
+// executes a Save, which copies the array first if it's shared (copy on write). They're
+// allocated from the scratch object, and reused as soon as no thread refers to them.
+uint32_t new_captures(NfaScratch& scratch, size_t num_slots) {
+  uint32_t id;
+  if (!scratch.free_arrays.empty()) {
+    id = scratch.free_arrays.back();
+    scratch.free_arrays.pop_back();
+  } else {
+    id = scratch.refs.size();
+    scratch.refs.push_back(0);
+    scratch.slots.resize(scratch.slots.size() + num_slots);
   }
+  scratch.refs[id] = 1;
+  return id;
+}
+
+void release_captures(NfaScratch& scratch, uint32_t id) {
+  if (--scratch.refs[id] == 0) scratch.free_arrays.push_back(id);
+}
+
+// Adds a thread at pc, with capture array caps, to threads. Follows Jump, Split and Save
+// instructions depth first in priority order (see Instruction::Split), so the threads end
+// up in the list in priority order. Threads reaching a pc which is already in the list
+// are dropped: the earlier thread has higher priority and would behave the same way.
+void add_thread(const Program& program, size_t pc, uint32_t caps, size_t idx,
+                size_t num_slots, SparseSet& threads, vector<int32_t>& thread_captures,
+                NfaScratch& scratch) {
+  vector<pair<size_t, uint32_t>>& stack = scratch.stack;
+  stack.push_back({pc, caps});
+  while (!stack.empty()) {
+    pc = stack.back().first;
+    caps = stack.back().second;
+    stack.pop_back();
+    if (threads.contains(pc)) {
+      release_captures(scratch, caps);
+      continue;
+    }
+    threads.insert(pc);
+    thread_captures[pc] = -1;
 
-  Thread& operator[](size_t idx) {
-    return threads[idx];
+    const Instruction& inst = program[pc];
+    switch (inst.type) {
+      case IType::Jump:
+        stack.push_back({pc + inst.offset, caps});
+        break;
+      case IType::Split: {
+        size_t preferred = inst.offset < 0 ? pc + inst.offset : pc + 1;
+        size_t other = inst.offset < 0 ? pc + 1 : pc + inst.offset;
+        scratch.refs[caps]++;
+        stack.push_back({other, caps});
+        stack.push_back({preferred, caps});
+        break;
+      }
+      case IType::Save:
+        if (scratch.refs[caps] > 1) {
+          uint32_t copy = new_captures(scratch, num_slots);
+          copy_n(scratch.slots.begin() + caps * num_slots, num_slots,
+                 scratch.slots.begin() + copy * num_slots);
+          release_captures(scratch, caps);
+          caps = copy;
+        }
+        scratch.slots[caps * num_slots + inst.slot] = idx;
+        stack.push_back({pc + 1, caps});
+        break;
+      default:
+        thread_captures[pc] = caps;
+        break;
+    }
   }
+}
 
-  const Thread& operator[](size_t idx) const {
-    return threads[idx];
+void set_groups(const size_t* slots, size_t num_groups, vector<Submatch>& groups) {
+  groups.assign(num_groups + 1, {string::npos, string::npos});
+  for (size_t group = 0; group <= num_groups; group++) {
+    if (slots[2 * group] != string::npos && slots[2 * group + 1] != string::npos) {
+      groups[group] = {slots[2 * group], slots[2 * group + 1]};
+    }
   }
+}
 
- private:
-  vector<Thread> threads;
-  vector<bool> used;
-};
+// Pike VM: the NFA simulation of match() above, where each thread also carries the capture
+// slots set along its path. Threads are kept in priority order, so when a thread matches,
+// the threads after it in the list can be dropped: any match they find is lower priority.
+// Higher priority threads keep running, and replace the match if they find one.
+//
+// Partial matches don't use match_all, since its loop would be preferred over starting a
+// match. Instead a new thread starts at each position, with the lowest priority, until a
+// match is found.
+bool match(const NfaProgram& compiled, const char* data, size_t size, NfaScratch& scratch,
+           bool partial, vector<Submatch>& groups) {
+  const Program& program = compiled.capture_re;
+  if (program.empty()) return false;
+  size_t num_slots = 2 * (compiled.num_groups + 1);
+  SparseSet* threads = &scratch.threads;
+  SparseSet* next_threads = &scratch.next_threads;
+  threads->reserve(program.size());
+  next_threads->reserve(program.size());
+  vector<int32_t>* captures = &scratch.captures;
+  vector<int32_t>* next_captures = &scratch.next_captures;
+  captures->resize(program.size());
+  next_captures->resize(program.size());
+  scratch.slots.clear();
+  scratch.refs.clear();
+  scratch.free_arrays.clear();
 
-bool match(const vector<Instruction>& program, const string& text, bool partial = false) {
-  ThreadList threads(program.size());
-  threads.add({0});
-  for (size_t idx = 0; idx <= text.size(); idx++) {
-    ThreadList next_threads(program.size());
-    for (size_t t = 0; t < threads.size(); t++) {
-      size_t pc = threads[t].pc;
-      if (threads[t].pc >= program.size()) {
-        cerr << "Invalid program counter " << pc
-             << ", program.size() is " << program.size() << endl;
-        return false;
+  int64_t matched = -1;
+  for (size_t idx = 0; idx <= size; idx++) {
+    if (matched == -1 && (partial || idx == 0)) {
+      if (partial && threads->empty() && compiled.can_skip) {
+        idx += find_first_in(compiled.first_bytes, data + idx, size - idx);
+        if (idx == size) break;
       }
+      uint32_t caps = new_captures(scratch, num_slots);
+      fill_n(scratch.slots.begin() + caps * num_slots, num_slots, string::npos);
+      add_thread(program, 0, caps, idx, num_slots, *threads, *captures, scratch);
+    }
+    if (threads->empty()) break;
+
+    next_threads->clear();
+    for (size_t t = 0; t < threads->size(); t++) {
+      size_t pc = (*threads)[t];
+      int32_t caps = (*captures)[pc];
+      if (caps == -1) continue;
 
       const Instruction& inst = program[pc];
+      bool consumed = false;
       switch (inst.type) {
         case IType::Literal:
-          if (idx < text.size() && inst.c == text[idx]) {
-            next_threads.add(pc+1);
-          }
-          break;
-        case IType::Wildcard:
-          if (idx < text.size() && inst.match_wildcard(text[idx])) {
-            next_threads.add(pc+1);
-          }
+          consumed = idx < size && inst.c == data[idx];
           break;
+        case IType::Wildcard:  // fallthrough
         case IType::Class:
-          if (idx < text.size() && inst.cclass->match(text[idx])) {
-            next_threads.add(pc+1);
-          }
-          break;
-        case IType::Jump:
-          threads.add(pc + inst.offset);
-          break;
-        case IType::Split:
-          threads.add(pc+1);
-          threads.add(pc + inst.offset);
+          consumed = idx < size && program.byte_set(inst).contains(data[idx]);
           break;
         case IType::Match:
-          if (partial || idx == text.size()) return true;
+          if (partial || idx == size) {
+            if (matched != -1) release_captures(scratch, matched);
+            matched = caps;
+            // Cut off the lower priority threads.
+            for (size_t rest = t + 1; rest < threads->size(); rest++) {
+              int32_t rest_caps = (*captures)[(*threads)[rest]];
+              if (rest_caps != -1) release_captures(scratch, rest_caps);
+            }
+            threads->clear();
+            continue;
+          }
           break;
         default:
           cerr << "Unknown instruction type" << endl;
           return false;
       }
+      if (consumed) {
+        add_thread(program, pc + 1, caps, idx + 1, num_slots, *next_threads, *next_captures,
+                   scratch);
+      } else {
+        release_captures(scratch, caps);
+      }
     }
-    threads = move(next_threads);
+    swap(threads, next_threads);
+    swap(captures, next_captures);
   }
-  return false;
+  if (matched == -1) return false;
+  set_groups(scratch.slots.data() + matched * num_slots, compiled.num_groups, groups);
+  return true;
+}
+
+// Adds a thread at pc for a match starting at start, as add_thread does, but all the
+// threads it adds share the same start, so there's nothing to copy.
+void add_start_thread(const Program& program, size_t pc, size_t start, SparseSet& threads,
+                      vector<size_t>& starts, vector<size_t>& stack) {
+  stack.push_back(pc);
+  while (!stack.empty()) {
+    pc = stack.back();
+    stack.pop_back();
+    if (threads.contains(pc)) continue;
+    threads.insert(pc);
+    starts[pc] = start;
+
+    const Instruction& inst = program[pc];
+    switch (inst.type) {
+      case IType::Jump:
+        stack.push_back(pc + inst.offset);
+        break;
+      case IType::Split:
+        if (inst.offset < 0) {
+          stack.push_back(pc + 1);
+          stack.push_back(pc + inst.offset);
+        } else {
+          stack.push_back(pc + inst.offset);
+          stack.push_back(pc + 1);
+        }
+        break;
+      case IType::Save:
+        stack.push_back(pc + 1);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+// The Pike VM reduced to group 0: the only capture a thread needs is where its match
+// started, which is a single value rather than a shared array. Finds the leftmost match
+// of program (which must be anchored, i.e. not unanchored()) in data[0, size), preferring
+// matches as the Pike VM does, and stops as soon as no higher priority thread is left.
+// skip is used as in run_threads.
+bool find_leftmost(const Program& program, const char* data, size_t size,
+                   NfaScratch& scratch, const ByteSet* skip, size_t& start, size_t& end) {
+  if (program.empty()) return false;
+  SparseSet* threads = &scratch.threads;
+  SparseSet* next_threads = &scratch.next_threads;
+  threads->reserve(program.size());
+  next_threads->reserve(program.size());
+  vector<size_t>* starts = &scratch.starts;
+  vector<size_t>* next_starts = &scratch.next_starts;
+  starts->resize(program.size());
+  next_starts->resize(program.size());
+
+  bool matched = false;
+  for (size_t idx = 0; idx <= size; idx++) {
+    if (!matched) {
+      if (threads->empty() && skip != nullptr) {
+        idx += find_first_in(*skip, data + idx, size - idx);
+        if (idx == size) break;
+      }
+      // Lowest priority: a match starting here only counts if none started earlier.
+      add_start_thread(program, 0, idx, *threads, *starts, scratch.pc_stack);
+    }
+    if (threads->empty()) break;
+
+    next_threads->clear();
+    for (size_t t = 0; t < threads->size(); t++) {
+      size_t pc = (*threads)[t];
+      const Instruction& inst = program[pc];
+      bool consumed = false;
+      switch (inst.type) {
+        case IType::Literal:
+          consumed = idx < size && inst.c == data[idx];
+          break;
+        case IType::Wildcard:  // fallthrough
+        case IType::Class:
+          consumed = idx < size && program.byte_set(inst).contains(data[idx]);
+          break;
+        case IType::Match:
+          matched = true;
+          start = (*starts)[pc];
+          end = idx;
+          // Cut off the lower priority threads.
+          t = threads->size();
+          continue;
+        default:
+          continue;
+      }
+      if (consumed) {
+        add_start_thread(program, pc + 1, (*starts)[pc], *next_threads, *next_starts,
+                         scratch.pc_stack);
+      }
+    }
+    swap(threads, next_threads);
+    swap(starts, next_starts);
+  }
+  return matched;
+}
+
+bool UreNfa::full_match(const char* data, size_t size) const {
+  return full_match(data, size, thread_scratch);
+}
+
+bool UreNfa::partial_match(const char* data, size_t size) const {
+  return partial_match(data, size, thread_scratch);
+}
+
+bool UreNfa::full_match(const char* data, size_t size, NfaScratch& scratch) const {
+  if (!ends_with(data, size, program->suffix)) return false;
+  if (!contains_literal(data, size, program->literal)) return false;
+  return match(program->re, data, size, scratch);
+}
+
+bool UreNfa::partial_match(const char* data, size_t size, NfaScratch& scratch) const {
+  if (!contains_literal(data, size, program->literal)) return false;
+  if (program->use_reverse_suffix) {
+    bool gave_up = false;
+    bool matched = reverse_suffix_match(*program, data, size, scratch, gave_up);
+    if (!gave_up) return matched;
+  }
+  const ByteSet* skip = program->can_skip ? &program->first_bytes : nullptr;
+  return match(program->partial_re, data, size, scratch, true, skip);
+}
+
+bool UreNfa::full_match(const string& text, NfaScratch& scratch) const {
+  return full_match(text.data(), text.size(), scratch);
+}
+
+bool UreNfa::partial_match(const string& text, NfaScratch& scratch) const {
+  return partial_match(text.data(), text.size(), scratch);
+}
+
+void UreNfa::match_batch(const StringBatch& batch, bool partial, vector<uint8_t>& out,
+                         size_t num_threads) const {
+  out.resize(batch.size);
+  for_each_range(batch.size, num_threads, [&](size_t begin, size_t end) {
+    NfaScratch& scratch = thread_scratch;
+    for (size_t i = begin; i < end; i++) {
+      const char* data = batch.row_data(i);
+      size_t size = batch.row_size(i);
+      out[i] = partial ? partial_match(data, size, scratch) : full_match(data, size, scratch);
+    }
+  });
+}
+
+bool UreNfa::full_match(const char* data, size_t size, vector<Submatch>& groups) const {
+  if (!ends_with(data, size, program->suffix)) return false;
+  if (!contains_literal(data, size, program->literal)) return false;
+  if (program->is_one_pass) {
+    size_t slots[max_one_pass_slots];
+    if (!one_pass_full_match(program->one_pass, data, size, slots)) return false;
+    set_groups(slots, program->num_groups, groups);
+    return true;
+  }
+  return match(*program, data, size, thread_scratch, false, groups);
+}
+
+bool UreNfa::partial_match(const char* data, size_t size, vector<Submatch>& groups) const {
+  if (!contains_literal(data, size, program->literal)) return false;
+  return match(*program, data, size, thread_scratch, true, groups);
+}
+
+bool UreNfa::full_match(const string& text, vector<Submatch>& groups) const {
+  return full_match(text.data(), text.size(), groups);
+}
+
+bool UreNfa::partial_match(const string& text, vector<Submatch>& groups) const {
+  return partial_match(text.data(), text.size(), groups);
+}
+
+bool UreNfa::find(const char* data, size_t size, size_t& start, size_t& end) const {
+  if (!contains_literal(data, size, program->literal)) return false;
+  const ByteSet* skip = program->can_skip ? &program->first_bytes : nullptr;
+  return find_leftmost(program->re, data, size, thread_scratch, skip, start, end);
 }
 
-bool UreNfa::full_match(const string& text) const {
-  return match(re, text);
+bool UreNfa::find(const string& text, size_t& start, size_t& end) const {
+  return find(text.data(), text.size(), start, end);
 }
 
-bool UreNfa::partial_match(const string& text) const {
-  return match(partial_re, text, true);
+MatchIterator UreNfa::find_all(const char* data, size_t size) const {
+  return MatchIterator(*this, data, size);
 }
 
-bool UreNfa::parsing_failed() const { return re.empty(); }
-ParseError UreNfa::parser_error_info() { return parser.error_info(); }
+MatchIterator UreNfa::find_all(const string& text) const {
+  return find_all(text.data(), text.size());
+}
+
+bool MatchIterator::next(size_t& start, size_t& end) {
+  if (pos > size || !re->find(data + pos, size - pos, start, end)) {
+    pos = size + 1;
+    return false;
+  }
+  start += pos;
+  end += pos;
+  pos = start == end ? end + 1 : end;
+  return true;
+}
+
+// Stream state layout: a flags byte, then a bitmap with a bit per pc of partial_re (the
+// larger of the two programs), set for the pcs in scratch.threads.
+const uint8_t stream_partial = 1;
+const uint8_t stream_matched = 2;
+
+size_t UreNfa::stream_state_size() const {
+  return 1 + (program->partial_re.size() + 7) / 8;
+}
+
+void UreNfa::begin(uint8_t* state, bool partial) const {
+  fill_n(state, stream_state_size(), 0);
+  state[0] = partial ? stream_partial : 0;
+  // If the pattern didn't parse, there are no threads, nor room for them.
+  if (program->re.empty()) return;
+  state[1] = 1;  // A single thread at pc 0.
+}
+
+// Whether state could have been saved by a UreNfa for re: no unknown flags, and no
+// threads past the end of re in a bitmap of bitmap_size bytes.
+bool valid_stream_state(const Program& re, const uint8_t* state, size_t bitmap_size) {
+  if (state[0] & ~(stream_partial | stream_matched)) return false;
+  for (size_t pc = re.size(); pc < 8 * bitmap_size; pc++) {
+    if (state[1 + pc / 8] & (1 << pc % 8)) return false;
+  }
+  return true;
+}
+
+// Loads the threads saved in state into scratch.threads.
+void load_threads(const Program& program, const uint8_t* state, NfaScratch& scratch) {
+  scratch.threads.reserve(program.size());
+  scratch.next_threads.reserve(program.size());
+  for (size_t pc = 0; pc < program.size(); pc++) {
+    if (state[1 + pc / 8] & (1 << pc % 8)) scratch.threads.insert(pc);
+  }
+}
+
+void UreNfa::feed(uint8_t* state, const char* data, size_t size) const {
+  bool partial = state[0] & stream_partial;
+  const Program& re = partial ? program->partial_re : program->re;
+  if (re.empty() || (state[0] & stream_matched)) return;
+  assert(valid_stream_state(re, state, stream_state_size() - 1));
+
+  NfaScratch& scratch = thread_scratch;
+  load_threads(re, state, scratch);
+  const ByteSet* skip = partial && program->can_skip ? &program->first_bytes : nullptr;
+  if (run_threads(re, data, size, false, scratch, partial, skip)) {
+    state[0] |= stream_matched;
+    return;
+  }
+  fill_n(state + 1, stream_state_size() - 1, 0);
+  for (size_t t = 0; t < scratch.threads.size(); t++) {
+    size_t pc = scratch.threads[t];
+    state[1 + pc / 8] |= 1 << pc % 8;
+  }
+}
+
+bool UreNfa::finish(const uint8_t* state) const {
+  bool partial = state[0] & stream_partial;
+  const Program& re = partial ? program->partial_re : program->re;
+  if (re.empty()) return false;
+  if (state[0] & stream_matched) return true;
+  assert(valid_stream_state(re, state, stream_state_size() - 1));
+
+  NfaScratch& scratch = thread_scratch;
+  load_threads(re, state, scratch);
+  return run_threads(re, nullptr, 0, true, scratch, partial, nullptr);
+}
+
+bool UreNfa::is_one_pass() const { return program->is_one_pass; }
+
+bool UreNfa::parsing_failed() const { return program->re.empty(); }
+ParseError UreNfa::parser_error_info() { return program->error; }
+
+shared_ptr<const NfaProgram> UreNfa::compiled_program() const { return program; }
 
 }  // namespace ure
\ No newline at end of file
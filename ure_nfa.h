@@ -2,30 +2,194 @@
 #define URE_NFA_H
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "batch.h"
+#include "one_pass.h"
 #include "parser.h"
+#include "sparse_set.h"
 #include "ure_interface.h"
 
 namespace ure {
 
 struct Regex;
 
-// No attempt has been made to make this implementation thread-safe.
+// Working memory for UreNfa's matching loop: the thread lists for the current and next
+// positions in the text. Lists are sized for the largest program they've been used with,
+// so once warmed up, matching with the same scratch object doesn't allocate.
+struct NfaScratch {
+  SparseSet threads;
+  SparseSet next_threads;
+
+  // Only used when reporting submatches (the Pike VM, see ure_nfa.cc). Each thread has an
+  // array of capture slots, shared between threads until one of them writes to it.
+  // captures[pc] is the array of the thread at pc in threads (-1 for Jump, Split and
+  // Save, which only appear in the list so they're visited once per position).
+  std::vector<std::int32_t> captures;
+  std::vector<std::int32_t> next_captures;
+  // The capture arrays, one after the other, their reference counts, and the unused ones.
+  std::vector<std::size_t> slots;
+  std::vector<std::uint32_t> refs;
+  std::vector<std::uint32_t> free_arrays;
+  // (pc, capture array) pairs still to be added by add_thread().
+  std::vector<std::pair<std::size_t, std::uint32_t>> stack;
+
+  // Only used by UreNfa::find: starts[pc] is where the match of the thread at pc started.
+  std::vector<std::size_t> starts;
+  std::vector<std::size_t> next_starts;
+  std::vector<std::size_t> pc_stack;
+};
+
+// Where a group matched: text.substr(start, end - start). Groups which didn't take part in
+// the match have start == end == std::string::npos.
+struct Submatch {
+  std::size_t start;
+  std::size_t end;
+
+  bool operator==(const Submatch& other) const {
+    return start == other.start && end == other.end;
+  }
+};
+
+// A compiled pattern. Never modified after construction, so it can be shared by any number
+// of UreNfa objects and threads.
+struct NfaProgram {
+  Program re;
+  Program partial_re;
+  // A string every match must contain (see prefilter.h), checked before running the NFA.
+  std::string literal;
+  // If can_skip is set, every match starts with a byte in first_bytes, so partial matching
+  // can skip ahead to the next such byte whenever no match is in progress.
+  ByteSet first_bytes;
+  bool can_skip = false;
+  // re compiled in reverse (see Parser::parse), and the string every match ends with
+  // ("" if there isn't one). If use_reverse_suffix is set, partial matching searches for
+  // the suffix and runs reverse_re backwards from each occurrence, instead of running
+  // partial_re over the whole text.
+  Program reverse_re;
+  std::string suffix;
+  bool use_reverse_suffix = false;
+  // re with Save instructions for each group, used to report submatches.
+  Program capture_re;
+  std::size_t num_groups = 0;
+  // If is_one_pass is set, full matches report submatches with one_pass instead of the
+  // Pike VM (see one_pass.h).
+  OnePassDfa one_pass;
+  bool is_one_pass = false;
+  // Where the pattern failed to parse, if re is empty.
+  ParseError error;
+};
+
+// Compiles pattern for UreNfa. If the pattern doesn't parse, the program's re is empty and
+// its error says why.
+std::shared_ptr<const NfaProgram> compile_nfa(const std::string& pattern);
+
+class UreNfa;
+
+// The successive matches of a pattern in a text, see UreNfa::find_all.
+class MatchIterator {
+ public:
+  MatchIterator(const UreNfa& re, const char* data, std::size_t size)
+    : re(&re), data(data), size(size), pos(0) {}
+
+  // Sets start and end to the next match and returns true, or returns false if there are
+  // no more matches.
+  bool next(std::size_t& start, std::size_t& end);
+
+ private:
+  const UreNfa* re;
+  const char* data;
+  std::size_t size;
+  // Where the search for the next match starts, or size + 1 once there can't be one.
+  std::size_t pos;
+};
+
+// Matching doesn't modify the object, so a UreNfa can be used from many threads at once.
+// Copies share the same compiled program.
+//
+// The overloads without an NfaScratch use one scratch object per thread (allocated the first
+// time the thread matches, and reused for any pattern after that), so they don't allocate or
+// take locks once warmed up. Callers which manage their own threads' memory can pass scratch
+// objects explicitly instead.
 class UreNfa : public Ure {
  public:
   UreNfa(const std::string& pattern);
-  bool full_match(const std::string& text) const override;
-  bool partial_match(const std::string& text) const override;
+  UreNfa(std::shared_ptr<const NfaProgram> program);
+  using Ure::full_match;
+  using Ure::partial_match;
+  bool full_match(const char* data, std::size_t size) const override;
+  bool partial_match(const char* data, std::size_t size) const override;
+  bool full_match(const char* data, std::size_t size, NfaScratch& scratch) const;
+  bool partial_match(const char* data, std::size_t size, NfaScratch& scratch) const;
+  bool full_match(const std::string& text, NfaScratch& scratch) const;
+  bool partial_match(const std::string& text, NfaScratch& scratch) const;
+
+  // Like full_match and partial_match, but on success also set groups[0] to the span of
+  // the whole match and groups[i] to that of the i-th parenthesized group (numbered in
+  // order of their "("). Still a single pass over the text, in time linear in its length.
+  //
+  // When there's more than one way to match, the one reported is the one Perl would find:
+  // the leftmost match, preferring earlier alternatives of |, and repeating ?, * and + as
+  // many times as possible. A group inside a repetition reports its last iteration. As in
+  // RE2, a repetition never continues with an iteration matching the empty string, so
+  // patterns like "(a|)*" can report a different match than Perl would.
+  //
+  // For one-pass patterns (see one_pass.h), full_match uses a one-pass DFA instead of the
+  // Pike VM, which is several times faster and gives the same results.
+  //
+  // Offsets in groups are relative to data.
+  bool full_match(const char* data, std::size_t size, std::vector<Submatch>& groups) const;
+  bool partial_match(const char* data, std::size_t size, std::vector<Submatch>& groups) const;
+  bool full_match(const std::string& text, std::vector<Submatch>& groups) const;
+  bool partial_match(const std::string& text, std::vector<Submatch>& groups) const;
+  bool is_one_pass() const;
+
+  // Finds the leftmost match in the text (preferring matches as in full_match with groups)
+  // and sets [start, end) to its span. Returns false if there's no match. Stops reading
+  // the text as soon as the match is certain, i.e. when no higher priority thread is left.
+  bool find(const char* data, std::size_t size, std::size_t& start, std::size_t& end) const;
+  bool find(const std::string& text, std::size_t& start, std::size_t& end) const;
+
+  // Iterates over the non-overlapping matches in the text, from left to right. Each search
+  // starts where the previous match ended (or one byte later, after an empty match), so
+  // the text is only read once apart from the bytes read to decide each match. The text
+  // must outlive the iterator.
+  MatchIterator find_all(const char* data, std::size_t size) const;
+  MatchIterator find_all(const std::string& text) const;
+
+  // Matches every string of batch, setting out[i] to 1 if string i matches (fully, or
+  // partially if partial is set) and 0 otherwise. Cheaper than a call per string: there's
+  // no virtual call or std::string per string, and each thread's scratch space is looked up
+  // once. With num_threads > 1, the batch is split between that many threads.
+  void match_batch(const StringBatch& batch, bool partial, std::vector<std::uint8_t>& out,
+                   std::size_t num_threads = 1) const;
+
+  // Streaming: matches a text which arrives in chunks, without holding on to it. The state
+  // of a match in progress is a blob of stream_state_size() bytes owned by the caller,
+  // which begin() initializes, and feed() updates with each chunk of text in order. Then
+  // finish() returns whether the whole text matched (fully, or partially if begin() was
+  // called with partial set). The result is the same as calling full_match or
+  // partial_match on the concatenated chunks.
+  //
+  // The blob is plain bytes (it holds the set of live threads as a bitmap), so it can be
+  // copied, stored or sent elsewhere between calls, but it's only valid for a UreNfa
+  // compiled from the same pattern. Passing feed() or finish() a blob from another pattern,
+  // or a damaged one, is undefined (debug builds assert that it fits the program).
+  std::size_t stream_state_size() const;
+  void begin(std::uint8_t* state, bool partial) const;
+  void feed(std::uint8_t* state, const char* data, std::size_t size) const;
+  bool finish(const std::uint8_t* state) const;
 
   bool parsing_failed() const override;
   ParseError parser_error_info();
 
+  std::shared_ptr<const NfaProgram> compiled_program() const;
+
  private:
-  std::vector<Instruction> re;
-  std::vector<Instruction> partial_re;
-  Parser parser;
+  std::shared_ptr<const NfaProgram> program;
 };
 
 }  // namespace ure
@@ -1,76 +1,120 @@
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <utility>
+#include <vector>
 
+#include "optimizer.h"
 #include "ure_recursive.h"
 
 namespace ure {
 
 using namespace std;
 
-UreRecursive::UreRecursive(const string& pattern) {
+UreRecursive::UreRecursive(const string& pattern, size_t max_text_size)
+  : max_text_size(max_text_size) {
   re = parser.parse(pattern);
   if (!re.empty()) {
-    partial_re = Instruction::match_all;
-    for (const Instruction& inst : re) {
-      partial_re.push_back(inst);
-    }
+    // Runs of Literals are compared with memcmp, and only their first byte's (pc, idx)
+    // pair is recorded in the bitmap.
+    re = optimize(re, true);
+    partial_re = re.unanchored();
   }
 }
 
-bool match(const vector<Instruction>& program, const string& text,
-           vector<vector<bool>>& visited, size_t pc, size_t idx,
-           bool partial = false) {
-  if (pc >= program.size()) {
-    cerr << "Invalid program counter " << pc << ", program.size() is " << program.size() << endl;
-    return false;
-  }
+// Working memory for match(), reused between calls on the same thread.
+struct BacktrackScratch {
+  // Bit pc * (text.size() + 1) + idx is set once (pc, idx) has been explored.
+  vector<uint64_t> visited;
+  // (pc, idx) pairs still to try: the second branches of Splits.
+  vector<pair<size_t, size_t>> stack;
+};
 
-  if (visited[pc][idx]) return false;  // Infinite loop
-  visited[pc][idx] = true;
+thread_local BacktrackScratch backtrack_scratch;
 
-  const Instruction& inst = program[pc];
-  switch (inst.type) {
-    case IType::Literal:
-      if (idx < text.size() && inst.c == text[idx]) {
-        return match(program, text, visited, pc + 1, idx + 1, partial);
-      }
-      return false;
-    case IType::Wildcard:
-      if (idx < text.size() && inst.match_wildcard(text[idx])) {
-        return match(program, text, visited, pc + 1, idx + 1, partial);
+bool match(const Program& program, const char* data, size_t size, bool partial = false) {
+  BacktrackScratch& scratch = backtrack_scratch;
+  size_t row = size + 1;
+  size_t num_words = (program.size() * row + 63) / 64;
+  if (scratch.visited.size() < num_words) scratch.visited.resize(num_words);
+  fill_n(scratch.visited.begin(), num_words, 0);
+  vector<pair<size_t, size_t>>& stack = scratch.stack;
+  stack.clear();
+
+  stack.push_back({0, 0});
+  while (!stack.empty()) {
+    size_t pc = stack.back().first;
+    size_t idx = stack.back().second;
+    stack.pop_back();
+
+    // Follow this path until it fails, saving the alternatives of any Splits on the way.
+    while (true) {
+      if (pc >= program.size()) {
+        cerr << "Invalid program counter " << pc
+             << ", program.size() is " << program.size() << endl;
+        return false;
       }
-      return false;
-    case IType::Class:
-      if (idx < text.size() && inst.cclass->match(text[idx])) {
-        return match(program, text, visited, pc + 1, idx + 1, partial);
+      size_t bit = pc * row + idx;
+      uint64_t mask = uint64_t{1} << (bit % 64);
+      if (scratch.visited[bit / 64] & mask) break;  // Explored already, or an infinite loop.
+      scratch.visited[bit / 64] |= mask;
+
+      const Instruction& inst = program[pc];
+      bool failed = false;
+      switch (inst.type) {
+        case IType::Literal:
+          failed = idx == size || inst.c != data[idx];
+          pc++;
+          idx++;
+          break;
+        case IType::Wildcard:  // fallthrough
+        case IType::Class:
+          failed = idx == size || !program.byte_set(inst).contains(data[idx]);
+          pc++;
+          idx++;
+          break;
+        case IType::String: {
+          const string& s = program.string_of(inst);
+          failed = size - idx < s.size() || memcmp(data + idx, s.data(), s.size()) != 0;
+          pc++;
+          idx += s.size();
+          break;
+        }
+        case IType::Jump:
+          pc += inst.offset;
+          break;
+        case IType::Save:
+          pc++;
+          break;
+        case IType::Split:
+          stack.push_back({pc + inst.offset, idx});
+          pc++;
+          break;
+        case IType::Match:
+          if (partial || idx == size) return true;
+          failed = true;
+          break;
+        default:
+          cerr << "Unknown instruction type" << endl;
+          return false;
       }
-      return false;
-    case IType::Jump:
-      return match(program, text, visited, pc + inst.offset, idx, partial);
-    case IType::Split:
-      return match(program, text, visited, pc + 1, idx, partial) ||
-             match(program, text, visited, pc + inst.offset, idx, partial);
-    case IType::Match:
-      return partial || idx == text.size();
-    default:
-      cerr << "Unknown instruction type" << endl;
-      return false;
+      if (failed) break;
+    }
   }
+  return false;
 }
 
-bool UreRecursive::full_match(const string& text) const {
-  vector<vector<bool>> visited(re.size(),
-      vector<bool>(text.size() + 1));
-  return match(re, text, visited, 0, 0);
+bool UreRecursive::full_match(const char* data, size_t size) const {
+  return fits(size) && !re.empty() && match(re, data, size);
 }
 
-bool UreRecursive::partial_match(const string& text) const {
-  vector<vector<bool>> visited(partial_re.size(),
-      vector<bool>(text.size() + 1));
-  return match(partial_re, text, visited, 0, 0, true);
+bool UreRecursive::partial_match(const char* data, size_t size) const {
+  return fits(size) && !partial_re.empty() && match(partial_re, data, size, true);
 }
 
 bool UreRecursive::parsing_failed() const { return re.empty(); }
 ParseError UreRecursive::parser_error_info() { return parser.error_info(); }
 
-}  // namespace ure
\ No newline at end of file
+}  // namespace ure
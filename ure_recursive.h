@@ -12,20 +12,39 @@ namespace ure {
 
 struct Regex;
 
-// No attempt has been made to make this implementation thread-safe.
+// Default limit on the length of texts UreRecursive will match.
+const std::size_t default_max_backtrack_text = 1 << 16;
+
+// Backtracking matcher: tries each path through the program in turn, exploring the
+// second branch of a Split only if the first fails. A bitmap of visited (pc, position)
+// pairs makes sure no pair is explored twice, so matching takes time and space
+// proportional to program size times text length. That makes it the fastest engine for
+// short texts, but for long texts the bitmap gets too big, so texts longer than
+// max_text_size are refused (see fits()), and should be matched with UreNfa instead.
+//
+// The backtracking stack and bitmap are kept per thread and reused between calls.
+// Matching doesn't modify the object, so it's safe to share between threads.
 class UreRecursive : public Ure {
  public:
-  UreRecursive(const std::string& pattern);
-  bool full_match(const std::string& text) const override;
-  bool partial_match(const std::string& text) const override;
+  UreRecursive(const std::string& pattern,
+               std::size_t max_text_size = default_max_backtrack_text);
+  using Ure::full_match;
+  using Ure::partial_match;
+  // Return false if !fits(size), so callers which can get longer texts should check
+  // fits() first (and use UreNfa for those which don't).
+  bool full_match(const char* data, std::size_t size) const override;
+  bool partial_match(const char* data, std::size_t size) const override;
+  bool fits(const std::string& text) const { return fits(text.size()); }
+  bool fits(std::size_t size) const { return size <= max_text_size; }
 
   bool parsing_failed() const override;
   ParseError parser_error_info();
 
  private:
-  std::vector<Instruction> re;
-  std::vector<Instruction> partial_re;
+  Program re;
+  Program partial_re;
   Parser parser;
+  std::size_t max_text_size;
 };
 
 }  // namespace ure
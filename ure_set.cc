@@ -0,0 +1,88 @@
+#include <cstddef>
+
+#include "prefilter.h"
+#include "ure_set.h"
+
+namespace ure {
+
+using namespace std;
+
+// Given patterns p0, p1, p2, produces code like:
+//
+//   0 Split n0 + 1
+//   1 (code for p0, ending in Match 0)
+//     Split n1 + 1
+//     (code for p1, ending in Match 1)
+//     (code for p2, ending in Match 2)
+//
+// where ni is the size of the code for pi. This is the alternation produced by
+// Parser::parse_alternate, minus the Jumps to a shared Match.
+UreSet::UreSet(const vector<string>& patterns, size_t max_cache_bytes)
+  : num_patterns(patterns.size()), failed(patterns.size()), literals_only(true) {
+  vector<string> literals;
+  for (size_t i = 0; i < patterns.size(); i++) {
+    Program program = parser.parse(patterns[i]);
+    if (program.empty()) {
+      failed = i;
+      re.clear();
+      return;
+    }
+    string literal;
+    if (literals_only && is_literal(program, literal)) {
+      literals.push_back(literal);
+    } else {
+      literals_only = false;
+    }
+    program.back() = Instruction::Match(i);
+    if (i + 1 < patterns.size()) {
+      re.push_back(Instruction::Split(program.size() + 1));
+    }
+    re.append(program);
+  }
+  if (re.empty()) return;
+  if (literals_only) {
+    literal_set = AhoCorasick(literals);
+    return;
+  }
+
+  full_dfa = LazyDfa(re, max_cache_bytes);
+  partial_dfa = LazyDfa(re.unanchored(), max_cache_bytes, true);
+}
+
+vector<size_t> match(LazyDfa& dfa, const Program& program, const char* data, size_t size,
+                     bool partial) {
+  int state = dfa.start_state();
+  for (size_t idx = 0; idx < size; idx++) {
+    state = dfa.next_state(state, data[idx]);
+    if (dfa.is_dead(state)) return {};
+  }
+
+  // Match instructions are in the same order as the patterns, and state_pcs is sorted.
+  vector<size_t> matches;
+  size_t offset = partial ? Instruction::match_all.size() : 0;
+  for (size_t pc : dfa.state_pcs(state)) {
+    // The Wildcard of the unanchored prefix is in every state of the partial DFA.
+    if (pc < offset) continue;
+    const Instruction& inst = program[pc - offset];
+    if (inst.type == IType::Match) matches.push_back(inst.id);
+  }
+  return matches;
+}
+
+vector<size_t> UreSet::full_match(const char* data, size_t size) const {
+  if (re.empty()) return {};
+  if (literals_only) return literal_set.full_match(data, size);
+  return match(full_dfa, re, data, size, false);
+}
+
+vector<size_t> UreSet::partial_match(const char* data, size_t size) const {
+  if (re.empty()) return {};
+  if (literals_only) return literal_set.partial_match(data, size);
+  return match(partial_dfa, re, data, size, true);
+}
+
+bool UreSet::parsing_failed() const { return failed != num_patterns; }
+size_t UreSet::failed_pattern() const { return failed; }
+ParseError UreSet::parser_error_info() { return parser.error_info(); }
+
+}  // namespace ure
@@ -0,0 +1,73 @@
+#ifndef URE_SET_H
+#define URE_SET_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "aho_corasick.h"
+#include "lazy_dfa.h"
+#include "parser.h"
+
+namespace ure {
+
+// Default bound on the memory used by each of UreSet's state caches. Larger than for a
+// single pattern, since each DFA state holds live program counters from every pattern.
+const std::size_t default_set_cache_bytes = 64 << 20;
+
+// Matches a text against many patterns at once, reporting which of them matched.
+//
+// All patterns are compiled into a single program, as if they were alternatives of one
+// big alternation, except that each alternative ends in its own Match instruction whose
+// id is the index of the pattern. The program is run with a lazily built DFA (see
+// lazy_dfa.h) in which Match instructions, once reached, stay in the state. So the text is
+// scanned once, and the final state says which patterns matched. After warm-up, the cost
+// per byte doesn't depend on the number of patterns.
+//
+// If every pattern is a plain string (no operators or classes), the patterns are matched
+// with an Aho-Corasick automaton instead (see aho_corasick.h).
+//
+// No attempt has been made to make this implementation thread-safe. Matching updates the
+// state cache even though the methods are const.
+class UreSet {
+ public:
+  UreSet(const std::vector<std::string>& patterns,
+         std::size_t max_cache_bytes = default_set_cache_bytes);
+
+  // Indices of the patterns which match the whole text, in increasing order.
+  std::vector<std::size_t> full_match(const char* data, std::size_t size) const;
+  // Indices of the patterns which match some substring of text, in increasing order.
+  std::vector<std::size_t> partial_match(const char* data, std::size_t size) const;
+
+  std::vector<std::size_t> full_match(const std::string& text) const {
+    return full_match(text.data(), text.size());
+  }
+  std::vector<std::size_t> partial_match(const std::string& text) const {
+    return partial_match(text.data(), text.size());
+  }
+
+  // True if any of the patterns failed to parse, in which case matching always returns no
+  // matches.
+  bool parsing_failed() const;
+  // Index of the first pattern which failed to parse, and details of the error. Only valid
+  // if parsing_failed().
+  std::size_t failed_pattern() const;
+  ParseError parser_error_info();
+
+ private:
+  Program re;
+  Parser parser;
+  std::size_t num_patterns;
+  // Index of the first pattern which failed to parse, or num_patterns.
+  std::size_t failed;
+  // Set if every pattern is a plain string, in which case literal_set is used instead of the
+  // DFAs.
+  bool literals_only;
+  AhoCorasick literal_set;
+  mutable LazyDfa full_dfa;
+  mutable LazyDfa partial_dfa;
+};
+
+}  // namespace ure
+
+#endif  // URE_SET_H
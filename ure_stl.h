@@ -1,7 +1,10 @@
 #ifndef URE_STL_H
 #define URE_STL_H
 
+#include <cstddef>
 #include <regex>
+#include <string>
+
 #include "ure_interface.h"
 
 namespace ure {
@@ -19,15 +22,18 @@ class UreStl : public Ure {
     }
   }
 
-  bool full_match(const std::string& text) const override {
-    return parsed && std::regex_match(text, re);
+  using Ure::full_match;
+  using Ure::partial_match;
+
+  bool full_match(const char* data, std::size_t size) const override {
+    return parsed && std::regex_match(data, data + size, re);
   }
 
-  bool partial_match(const std::string& text) const override {
-    return parsed && std::regex_search(text, re);
+  bool partial_match(const char* data, std::size_t size) const override {
+    return parsed && std::regex_search(data, data + size, re);
   }
 
-  bool parsing_failed() const { return !parsed; }
+  bool parsing_failed() const override { return !parsed; }
 
  private:
   bool parsed;
@@ -1,11 +1,20 @@
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <regex>
 #include <string>
+#include <thread>
 
 #include <gtest/gtest.h>
 
+#include "program_cache.h"
+#include "rule_file.h"
+#include "ure_bit_nfa.h"
+#include "ure_dfa.h"
+#include "ure_min_dfa.h"
 #include "ure_nfa.h"
 #include "ure_recursive.h"
+#include "ure_set.h"
 #include "ure_stl.h"
 
 using namespace ure;
@@ -115,6 +124,32 @@ void test_class(const string& pattern) {
   }
 }
 
+// Checks that streaming each text in chunks, split at every pair of positions, gives the
+// same results as matching it in one piece. Midway through, the stream state is copied
+// into an engine compiled separately from the same pattern.
+template<typename Engine>
+void test_stream(const string& pattern, const vector<string>& texts, size_t state_size) {
+  Engine re(pattern), other(pattern);
+  vector<uint8_t> state(state_size), copy(state_size);
+  for (const string& text : texts) {
+    for (size_t i = 0; i <= text.size(); i++) {
+      for (size_t j = i; j <= text.size(); j++) {
+        for (bool partial : {false, true}) {
+          re.begin(state.data(), partial);
+          re.feed(state.data(), text.data(), i);
+          re.feed(state.data(), text.data() + i, j - i);
+          copy = state;
+          other.feed(copy.data(), text.data() + j, text.size() - j);
+          bool expected = partial ? re.partial_match(text) : re.full_match(text);
+          EXPECT_EQ(expected, other.finish(copy.data()))
+              << "Pattern: \"" << pattern << "\", Text: \"" << text << "\", chunks at "
+              << i << ", " << j << (partial ? " (partial)" : " (full)");
+        }
+      }
+    }
+  }
+}
+
 TEST(UreTest, TestRecursive) {
   UreRecursive ure("a(bb)+a");
   ASSERT_FALSE(ure.parsing_failed());
@@ -130,6 +165,19 @@ TEST(UreTest, TestRecursive) {
 
   ASSERT_TRUE(UreRecursive("abc").partial_match("\nabc\n"));
 
+  // Long texts don't overflow the stack, and texts over the limit are refused.
+  string long_text(1 << 20, 'a');
+  UreRecursive unlimited("(a|b)*a", long_text.size());
+  ASSERT_TRUE(unlimited.fits(long_text));
+  ASSERT_TRUE(unlimited.full_match(long_text));
+  ASSERT_TRUE(unlimited.partial_match("b" + long_text.substr(1)));
+  ASSERT_FALSE(unlimited.fits(long_text + "b"));
+  ASSERT_FALSE(unlimited.full_match(long_text + "b"));
+  UreRecursive limited("a*", 4);
+  ASSERT_TRUE(limited.full_match("aaaa"));
+  ASSERT_FALSE(limited.fits("aaaaa"));
+  ASSERT_FALSE(limited.full_match("aaaaa"));
+
   test_class<UreStl, UreRecursive>(".");
   test_class<UreStl, UreNfa>("\\d");
   test_class<UreStl, UreNfa>("\\D");
@@ -175,6 +223,62 @@ TEST(UreTest, TestNfa) {
   ASSERT_EQ(1, bad.parser_error_info().idx);
 
   ASSERT_TRUE(UreNfa("abc").partial_match("\nabc\n"));
+
+  // Scratch objects can be shared between patterns of different sizes.
+  NfaScratch scratch;
+  UreNfa small("a"), large("(a|b)*c(a|b)*d");
+  ASSERT_TRUE(small.full_match("a", scratch));
+  ASSERT_TRUE(large.full_match("abcbad", scratch));
+  ASSERT_FALSE(large.partial_match("abcba", scratch));
+  ASSERT_TRUE(small.partial_match("bab", scratch));
+  ASSERT_FALSE(small.full_match("ab", scratch));
+
+  // A single UreNfa (and copies of it, which share the compiled program) can be used from
+  // several threads at once.
+  UreNfa shared("(a|b)*c");
+  vector<thread> threads;
+  vector<int> results(8, 0);
+  for (size_t i = 0; i < results.size(); i++) {
+    threads.emplace_back([&shared, &results, i]() {
+      UreNfa copy = shared;
+      for (int j = 0; j < 1000; j++) {
+        results[i] += shared.full_match("ababc") + copy.partial_match("xxcxx")
+                      + shared.full_match("abab");
+      }
+    });
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(vector<int>(8, 2000), results);
+
+  // Patterns ending in a literal, whose first bytes don't narrow the search, are matched by
+  // searching for the literal and running the reversed program back from it.
+  UreNfa json(".*\\.json");
+  ASSERT_TRUE(json.compiled_program()->use_reverse_suffix);
+  EXPECT_EQ(".json", json.compiled_program()->suffix);
+  EXPECT_TRUE(json.partial_match("GET /a/b.json HTTP"));
+  EXPECT_FALSE(json.partial_match("GET /a/b.jso HTTP"));
+  EXPECT_TRUE(json.full_match("/a/b.json"));
+  EXPECT_FALSE(json.full_match("/a/b.json "));
+  EXPECT_FALSE(UreNfa("x.*b").compiled_program()->use_reverse_suffix);
+  // Suffixes which occur often but never end a match would make the backward runs
+  // quadratic, so the search falls back to scanning forwards.
+  UreNfa words("\\w*x\\w*b");
+  ASSERT_TRUE(words.compiled_program()->use_reverse_suffix);
+  string bs(1 << 20, 'b');
+  EXPECT_FALSE(words.partial_match(bs));
+  EXPECT_TRUE(words.partial_match(bs + " xb"));
+  EXPECT_TRUE(words.partial_match("x" + bs));
+
+  vector<string> stream_texts = {"", "a", "ab@cd.com", "xx ab@cd.com yy", "ab@cd", "@.com"};
+  test_stream<UreNfa>("\\w+@\\w+\\.com", stream_texts,
+                      UreNfa("\\w+@\\w+\\.com").stream_state_size());
+  test_stream<UreNfa>("(a|b)*c?", {"", "abab", "abc", "abcx"},
+                      UreNfa("(a|b)*c?").stream_state_size());
+  // A pattern which doesn't parse never matches, and its state is a lone flags byte.
+  test_stream<UreNfa>("a(b", {"", "ab"}, UreNfa("a(b").stream_state_size());
+
   test_class<UreStl, UreNfa>(".");
   test_class<UreStl, UreNfa>("\\d");
   test_class<UreStl, UreNfa>("\\D");
@@ -204,4 +308,563 @@ TEST(UreTest, TestNfa) {
   test_class<UreStl, UreNfa>("[a-za-z]");
 
   test_all_regexes<UreStl, UreNfa>("abc.+*?()|\\", 4, "abcd", 4);
-}
\ No newline at end of file
+}
+
+// Compares the submatches UreNfa reports with std::regex's, for every pattern and text
+// made of the given characters. Patterns where a repeated group can match the empty
+// string are skipped: like RE2, UreNfa won't repeat an empty iteration, so it can report
+// a different (but valid) match there.
+void test_all_submatches(const string& re_chars, int max_re_length,
+                         const string& text_chars, int max_text_length) {
+  vector<string> skipped = forbidden_sequences;
+  skipped.insert(skipped.end(), {"()", "(|", "|)", "||", "?)", "*)"});
+  for (int length = 0; length <= max_re_length; length++) {
+    string pattern(length, ' ');
+    for (int re_idx = 0; re_idx < pow(re_chars.size(), length); re_idx++) {
+      for (int i = 0; i < length; i++) {
+        pattern[length - i - 1] = re_chars[(re_idx / pow(re_chars.size(), i)) % re_chars.size()];
+      }
+      bool valid = true;
+      for (const string& seq : skipped) {
+        if (pattern.find(seq) != string::npos) valid = false;
+      }
+      UreNfa re(pattern);
+      if (!valid || re.parsing_failed()) continue;
+      regex reference(pattern);
+
+      for (int text_length = 0; text_length <= max_text_length; text_length++) {
+        string text(text_length, ' ');
+        for (int text_idx = 0; text_idx < pow(text_chars.size(), text_length); text_idx++) {
+          for (int i = 0; i < text_length; i++) {
+            text[i] = text_chars[(text_idx / pow(text_chars.size(), i)) % text_chars.size()];
+          }
+          for (bool partial : {false, true}) {
+            smatch expected_match;
+            bool expected = partial ? regex_search(text, expected_match, reference)
+                                    : regex_match(text, expected_match, reference);
+            vector<Submatch> groups;
+            bool matched = partial ? re.partial_match(text, groups) : re.full_match(text, groups);
+            ASSERT_EQ(expected, matched)
+                << "Pattern: \"" << pattern << "\", Text: \"" << text << "\"";
+            if (!matched) continue;
+
+            vector<Submatch> expected_groups;
+            for (size_t i = 0; i < expected_match.size(); i++) {
+              if (!expected_match[i].matched) {
+                expected_groups.push_back({string::npos, string::npos});
+              } else {
+                size_t start = expected_match.position(i);
+                expected_groups.push_back({start, start + expected_match.length(i)});
+              }
+            }
+            EXPECT_EQ(expected_groups, groups)
+                << "Pattern: \"" << pattern << "\", Text: \"" << text << "\"";
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(UreTest, TestNfaSubmatches) {
+  UreNfa ure("(\\w+)@(\\w+)\\.com");
+  vector<Submatch> groups;
+  ASSERT_TRUE(ure.partial_match("mail bob@example.com now", groups));
+  ASSERT_EQ(3, groups.size());
+  EXPECT_EQ((Submatch{5, 20}), groups[0]);
+  EXPECT_EQ((Submatch{5, 8}), groups[1]);
+  EXPECT_EQ((Submatch{9, 16}), groups[2]);
+  ASSERT_FALSE(ure.full_match("mail bob@example.com now", groups));
+  ASSERT_TRUE(ure.full_match("bob@example.com", groups));
+  EXPECT_EQ((Submatch{0, 3}), groups[1]);
+
+  // Leftmost match, then the first alternative, and greedy quantifiers.
+  ASSERT_TRUE(UreNfa("(a|ab)(c|bcd)").partial_match("xabcd", groups));
+  EXPECT_EQ((vector<Submatch>{{1, 5}, {1, 2}, {2, 5}}), groups);
+  ASSERT_TRUE(UreNfa("(a+)(a*)").full_match("aaa", groups));
+  EXPECT_EQ((vector<Submatch>{{0, 3}, {0, 3}, {3, 3}}), groups);
+  ASSERT_TRUE(UreNfa("(a?)(a?)b").partial_match("ab", groups));
+  EXPECT_EQ((vector<Submatch>{{0, 2}, {0, 1}, {1, 1}}), groups);
+
+  // Groups which don't take part in the match, and the last iteration of a repeated group.
+  size_t npos = string::npos;
+  ASSERT_TRUE(UreNfa("(x)?(a|(b))+").full_match("abba", groups));
+  EXPECT_EQ((vector<Submatch>{{0, 4}, {npos, npos}, {3, 4}, {2, 3}}), groups);
+
+  // One-pass patterns use a one-pass DFA for full matches. The comparisons below cover both
+  // kinds of pattern.
+  EXPECT_TRUE(ure.is_one_pass());
+  EXPECT_TRUE(UreNfa("(a|b(c))*d").is_one_pass());
+  EXPECT_FALSE(UreNfa("(\\w+)(\\w+)").is_one_pass());
+  EXPECT_FALSE(UreNfa("(a|ab)c").is_one_pass());
+  UreNfa one_pass("(a|b(c))*d");
+  ASSERT_TRUE(one_pass.full_match("abcad", groups));
+  EXPECT_EQ((vector<Submatch>{{0, 5}, {3, 4}, {2, 3}}), groups);
+  ASSERT_FALSE(one_pass.full_match("abcadd", groups));
+
+  test_all_submatches("ab|()*+?", 5, "ab", 4);
+  test_all_submatches("a.|(\\d)+", 5, "a1", 3);
+}
+
+vector<Submatch> find_all(const UreNfa& re, const string& text) {
+  vector<Submatch> matches;
+  MatchIterator it = re.find_all(text);
+  size_t start, end;
+  while (it.next(start, end)) matches.push_back({start, end});
+  return matches;
+}
+
+TEST(UreTest, TestNfaFind) {
+  UreNfa ure("\\w+@\\w+\\.com");
+  size_t start, end;
+  ASSERT_TRUE(ure.find("mail bob@example.com or eve@example.com", start, end));
+  EXPECT_EQ(5, start);
+  EXPECT_EQ(20, end);
+  EXPECT_FALSE(ure.find("mail bob@example.org", start, end));
+  EXPECT_EQ((vector<Submatch>{{5, 20}, {24, 39}}),
+            find_all(ure, "mail bob@example.com or eve@example.com"));
+
+  // Leftmost, then the first alternative, not the longest match.
+  ASSERT_TRUE(UreNfa("b|abc|ab").find("xabcd", start, end));
+  EXPECT_EQ((Submatch{1, 4}), (Submatch{start, end}));
+  EXPECT_EQ((vector<Submatch>{{1, 3}, {3, 5}}), find_all(UreNfa("ab|cd|abcd"), "xabcdx"));
+
+  // After an empty match, the next search starts one byte later.
+  EXPECT_EQ((vector<Submatch>{{0, 0}, {1, 3}, {3, 3}}), find_all(UreNfa("a*"), "baa"));
+  EXPECT_EQ((vector<Submatch>{{0, 0}, {1, 1}, {2, 2}}), find_all(UreNfa("x?"), "ab"));
+  EXPECT_EQ((vector<Submatch>{}), find_all(UreNfa("a(b"), "ab"));
+
+  // Every match agrees with partial_match on the rest of the text.
+  for (const char* pattern : {"a+b?", "(a|ab)(c|bcd)", "[^ ]+", "b*", "\\d+|x"}) {
+    UreNfa re(pattern);
+    string text = "aab abcd 12x3 bbb a";
+    size_t pos = 0;
+    for (const Submatch& match : find_all(re, text)) {
+      vector<Submatch> groups;
+      ASSERT_TRUE(re.partial_match(text.substr(pos), groups)) << pattern;
+      EXPECT_EQ((Submatch{pos + groups[0].start, pos + groups[0].end}), match) << pattern;
+      pos = match.start == match.end ? match.end + 1 : match.end;
+    }
+    vector<Submatch> groups;
+    EXPECT_TRUE(pos > text.size() || !re.partial_match(text.substr(pos), groups)) << pattern;
+  }
+
+  // An optional item at the end of a loop's body is tried before the loop repeats.
+  ASSERT_TRUE(UreNfa("(ab?)*").find("ab", start, end));
+  EXPECT_EQ((Submatch{0, 2}), (Submatch{start, end}));
+  ASSERT_TRUE(UreNfa("x(ab?)*").find("xab", start, end));
+  EXPECT_EQ((Submatch{0, 3}), (Submatch{start, end}));
+  EXPECT_EQ((vector<Submatch>{{0, 3}, {3, 3}, {4, 7}, {7, 7}}),
+            find_all(UreNfa("(ab?)*"), "abaxaba"));
+  EXPECT_EQ((vector<Submatch>{{0, 6}, {7, 10}}), find_all(UreNfa("b(c(a|cb?))*"), "bccbcaxbcc"));
+}
+
+// Checks that matching every slice of text in place gives the same result as matching a
+// copy of it.
+template<typename Engine>
+void test_slices(const string& pattern, const string& text) {
+  Engine re(pattern);
+  for (size_t begin = 0; begin <= text.size(); begin++) {
+    for (size_t end = begin; end <= text.size(); end++) {
+      string slice = text.substr(begin, end - begin);
+      EXPECT_EQ(re.full_match(slice), re.full_match(text.data() + begin, end - begin))
+        << pattern << " on " << slice;
+      EXPECT_EQ(re.partial_match(slice), re.partial_match(text.data() + begin, end - begin))
+        << pattern << " on " << slice;
+    }
+  }
+}
+
+TEST(UreTest, TestSlices) {
+  for (const char* pattern : {"a(bb)+a", "\\w+@\\w+\\.com", "(a|b)*c?", "abba"}) {
+    string text = "xabbaabbbbac ab@cd.comx";
+    test_slices<UreStl>(pattern, text);
+    test_slices<UreNfa>(pattern, text);
+    test_slices<UreRecursive>(pattern, text);
+    test_slices<UreDfa>(pattern, text);
+    test_slices<UreMinDfa>(pattern, text);
+    test_slices<UreBitNfa>(pattern, text);
+  }
+
+  vector<Submatch> groups;
+  string text = "to: bob@example.com, cc: eve@example.org";
+  ASSERT_TRUE(UreNfa("(\\w+)@(\\w+)\\.com").full_match(text.data() + 4, 15, groups));
+  EXPECT_EQ((vector<Submatch>{{0, 15}, {0, 3}, {4, 11}}), groups);
+
+  UreSet set({"bob", "eve", "\\w+@\\w+\\.org"});
+  EXPECT_EQ((vector<size_t>{0}), set.partial_match(text.data(), 19));
+  EXPECT_EQ((vector<size_t>{1, 2}), set.partial_match(text.data() + 21, text.size() - 21));
+  UreSet literals({"bob", "eve"});
+  EXPECT_EQ((vector<size_t>{1}), literals.full_match(text.data() + 25, 3));
+}
+
+// Checks that match_batch gives the same results as matching each string on its own.
+template<typename Engine>
+void test_match_batch(const string& pattern, const vector<string>& texts) {
+  string data;
+  vector<int32_t> offsets = {0};
+  for (const string& text : texts) {
+    data += text;
+    offsets.push_back(data.size());
+  }
+  StringBatch batch = {data.data(), offsets.data(), texts.size()};
+  Engine re(pattern);
+  vector<uint8_t> out;
+  for (bool partial : {false, true}) {
+    for (size_t threads : {1, 3}) {
+      re.match_batch(batch, partial, out, threads);
+      ASSERT_EQ(texts.size(), out.size());
+      for (size_t i = 0; i < texts.size(); i++) {
+        EXPECT_EQ(partial ? re.partial_match(texts[i]) : re.full_match(texts[i]), out[i])
+          << pattern << " on " << texts[i] << (partial ? " (partial)" : "");
+      }
+    }
+  }
+}
+
+TEST(UreTest, TestMatchBatch) {
+  vector<string> texts = {"", "a", "ab@cd.com", "xx ab@cd.com yy", "ab@cd", "@.com", "abc"};
+  test_match_batch<UreNfa>("\\w+@\\w+\\.com", texts);
+  test_match_batch<UreMinDfa>("\\w+@\\w+\\.com", texts);
+  test_match_batch<UreNfa>("(a|b)*c?", texts);
+  test_match_batch<UreMinDfa>("(a|b)*c?", texts);
+  test_match_batch<UreNfa>("abc", {});
+}
+
+TEST(UreTest, TestProgramCache) {
+  ProgramCache cache(2);
+  shared_ptr<const NfaProgram> a = cache.get("a+");
+  EXPECT_EQ(a, cache.get("a+"));
+  cache.get("b+");
+  cache.get("a+");
+  // "b+" is the least recently used.
+  cache.get("c+");
+  EXPECT_EQ(a, cache.get("a+"));
+  ProgramCache::Stats stats = cache.stats();
+  EXPECT_EQ(3, stats.hits);
+  EXPECT_EQ(3, stats.misses);
+  EXPECT_EQ(1, stats.evictions);
+  EXPECT_EQ(2, stats.size);
+
+  UreNfa re(cache.get("b+"));
+  EXPECT_TRUE(re.full_match("bbb"));
+  EXPECT_FALSE(re.full_match("aaa"));
+  EXPECT_EQ(4, cache.stats().misses);
+  UreNfa bad(cache.get("a(b"));
+  EXPECT_TRUE(bad.parsing_failed());
+  EXPECT_EQ(1, bad.parser_error_info().idx);
+
+  cache.set_capacity(1);
+  EXPECT_EQ(1, cache.stats().size);
+  cache.clear();
+  EXPECT_EQ(0, cache.stats().size);
+  EXPECT_EQ(0, cache.stats().hits);
+
+  // Concurrent lookups, with enough patterns to keep evicting.
+  vector<thread> threads;
+  for (size_t t = 0; t < 4; t++) {
+    threads.emplace_back([&cache, t]() {
+      for (size_t i = 0; i < 200; i++) {
+        string word(1 + (i + t) % 3, 'x');
+        UreNfa re(cache.get(word + "|y"));
+        EXPECT_TRUE(re.full_match(word));
+      }
+    });
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  stats = cache.stats();
+  EXPECT_EQ(800, stats.hits + stats.misses);
+  EXPECT_EQ(1, stats.size);
+  EXPECT_EQ(&ProgramCache::global(), &ProgramCache::global());
+}
+
+TEST(UreTest, TestDfa) {
+  UreDfa ure("a(bb)+a");
+  ASSERT_FALSE(ure.parsing_failed());
+  ASSERT_TRUE(ure.full_match("abbbba"));
+  ASSERT_FALSE(ure.full_match("abbba"));
+  ASSERT_FALSE(ure.full_match("zzzabbbbazzz"));
+  ASSERT_TRUE(ure.partial_match("zzzabbbbazzz"));
+  ASSERT_FALSE(ure.partial_match("zzzabbbazzz"));
+
+  UreDfa bad("a(b");
+  ASSERT_TRUE(bad.parsing_failed());
+  ASSERT_EQ(1, bad.parser_error_info().idx);
+
+  ASSERT_TRUE(UreDfa("abc").partial_match("\nabc\n"));
+  test_class<UreStl, UreDfa>(".");
+  test_class<UreStl, UreDfa>("\\d");
+  test_class<UreStl, UreDfa>("\\D");
+  test_class<UreStl, UreDfa>("\\s");
+  test_class<UreStl, UreDfa>("\\S");
+  test_class<UreStl, UreDfa>("\\w");
+  test_class<UreStl, UreDfa>("\\W");
+  test_class<UreStl, UreDfa>("[a-zA-Z]");
+  test_class<UreStl, UreDfa>("[^a A-Z$0-9]");
+  test_class<UreStl, UreDfa>("[]");
+  test_class<UreStl, UreDfa>("[^]");
+
+  test_all_regexes<UreStl, UreDfa>("abc.+*?()|\\", 4, "abcd", 4);
+}
+
+TEST(UreTest, TestDfaCacheFlush) {
+  // A cache too small to hold more than one state forces a flush on almost every byte,
+  // which must not change the results.
+  string pattern = "(a|b)*a(a|b)(a|b)";
+  UreStl reference(pattern);
+  UreDfa tiny(pattern, 1);
+  test_all_patterns(reference, tiny, pattern, "ab", 8);
+  EXPECT_GT(tiny.cache_flushes(), 0);
+}
+
+TEST(UreTest, TestMinDfa) {
+  UreMinDfa ure("a(bb)+a");
+  ASSERT_FALSE(ure.parsing_failed());
+  ASSERT_FALSE(ure.compile_failed());
+  ASSERT_TRUE(ure.full_match("abbbba"));
+  ASSERT_FALSE(ure.full_match("abbba"));
+  ASSERT_FALSE(ure.full_match("zzzabbbbazzz"));
+  ASSERT_TRUE(ure.partial_match("zzzabbbbazzz"));
+  ASSERT_FALSE(ure.partial_match("zzzabbbazzz"));
+
+  UreMinDfa bad("a(b");
+  ASSERT_TRUE(bad.parsing_failed());
+  ASSERT_FALSE(bad.compile_failed());
+  ASSERT_EQ(1, bad.parser_error_info().idx);
+
+  // Equivalent patterns minimize to the same number of states.
+  EXPECT_EQ(UreMinDfa("(a|b)*").num_states(false), UreMinDfa("(a*b*)*").num_states(false));
+  // Start, after "a", after "ab", and dead.
+  EXPECT_EQ(4, UreMinDfa("ab+").num_states(false));
+
+  // Unanchored search for "a followed by n arbitrary characters" needs 2^n states.
+  UreMinDfa exploding("a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)", 64);
+  ASSERT_FALSE(exploding.parsing_failed());
+  ASSERT_TRUE(exploding.compile_failed());
+  EXPECT_FALSE(exploding.full_match("aaaaaaaaa"));
+
+  ASSERT_TRUE(UreMinDfa("abc").partial_match("\nabc\n"));
+  test_class<UreStl, UreMinDfa>(".");
+  test_class<UreStl, UreMinDfa>("\\d");
+  test_class<UreStl, UreMinDfa>("\\D");
+  test_class<UreStl, UreMinDfa>("\\s");
+  test_class<UreStl, UreMinDfa>("\\S");
+  test_class<UreStl, UreMinDfa>("\\w");
+  test_class<UreStl, UreMinDfa>("\\W");
+  test_class<UreStl, UreMinDfa>("[a-zA-Z]");
+  test_class<UreStl, UreMinDfa>("[^a A-Z$0-9]");
+  test_class<UreStl, UreMinDfa>("[]");
+  test_class<UreStl, UreMinDfa>("[^]");
+
+  test_all_regexes<UreStl, UreMinDfa>("abc.+*?()|\\", 4, "abcd", 4);
+
+  test_stream<UreMinDfa>("\\w+@\\w+\\.com",
+                         {"", "a", "ab@cd.com", "xx ab@cd.com yy", "ab@cd", "@.com"},
+                         min_dfa_stream_state_size);
+  test_stream<UreMinDfa>("(a|b)*c?", {"", "abab", "abc", "abcx"}, min_dfa_stream_state_size);
+
+  // Long enough that runs from different states are merged part way through a chunk.
+  string long_text;
+  for (int i = 0; i < 200; i++) long_text += "ab@cd.com x" + to_string(i) + " ";
+  for (const char* pattern : {"\\w+@\\w+\\.com", "(\\w+@\\w+\\.com |x\\d+ )*", "a(bb)+a"}) {
+    UreMinDfa re(pattern);
+    for (const string& text : {string(""), string("abbbba"), string("abbba"), long_text,
+                               long_text.substr(0, long_text.size() - 1)}) {
+      for (size_t threads : {1, 2, 3, 7, 16}) {
+        EXPECT_EQ(re.full_match(text), re.parallel_full_match(text, threads))
+          << pattern << " on " << text << " with " << threads << " threads";
+      }
+    }
+  }
+  // Slices of a larger buffer are matched in place.
+  UreMinDfa email("\\w+@\\w+\\.com");
+  string buffer = " ab@cd.com ";
+  EXPECT_TRUE(email.parallel_full_match(buffer.data() + 1, buffer.size() - 2, 4));
+  EXPECT_FALSE(email.parallel_full_match(buffer.data() + 1, buffer.size() - 1, 4));
+}
+
+TEST(UreTest, TestRuleFile) {
+  string path = testing::TempDir() + "ure_test_rules";
+  vector<string> patterns = {"a(bb)+a", "[a-c]x|[^0-9-]+", "", "(a|b)*a(a|b)(a|b)(a|b)"};
+  ASSERT_TRUE(write_rule_file(path, patterns, 10));
+  shared_ptr<const RuleFile> file = RuleFile::open(path);
+  ASSERT_NE(nullptr, file);
+  ASSERT_EQ(patterns.size(), file->size());
+
+  Parser parser;
+  vector<string> texts = {"", "abba", "abbba", "ax", "xx abbbba", "-5", "baaab", "aaaa"};
+  for (size_t i = 0; i < patterns.size(); i++) {
+    EXPECT_EQ(patterns[i], file->pattern(i));
+    Program program = parser.parse(patterns[i]);
+    EXPECT_EQ(program, file->program(i));
+    EXPECT_EQ(program.class_table(), file->program(i).class_table());
+  }
+  // The last pattern's DFA needs more than 10 states.
+  EXPECT_FALSE(file->has_dfa(3));
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(file->has_dfa(i));
+    UreMinDfa expected(patterns[i]);
+    UreMinDfa loaded(file->dfa(i, false), file->dfa(i, true));
+    EXPECT_FALSE(loaded.parsing_failed());
+    EXPECT_EQ(expected.num_states(false), loaded.num_states(false));
+    for (const string& text : texts) {
+      EXPECT_EQ(expected.full_match(text), loaded.full_match(text)) << i << " " << text;
+      EXPECT_EQ(expected.partial_match(text), loaded.partial_match(text)) << i << " " << text;
+    }
+  }
+
+  // DFAs keep the file mapped.
+  UreMinDfa re(file->dfa(0, false), file->dfa(0, true));
+  file.reset();
+  EXPECT_TRUE(re.full_match("abba"));
+
+  // Damaged files and other versions are rejected.
+  string contents;
+  {
+    ifstream in(path, ios::binary);
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  }
+  string damaged = path + "_damaged";
+  auto open_damaged = [&](size_t offset, char c) {
+    string copy = contents;
+    copy[offset] = c;
+    ofstream(damaged, ios::binary | ios::trunc) << copy;
+    return RuleFile::open(damaged);
+  };
+  ofstream(damaged, ios::binary) << contents.substr(0, contents.size() - 1);
+  EXPECT_EQ(nullptr, RuleFile::open(damaged));
+  ofstream(damaged, ios::binary | ios::trunc) << contents.substr(0, 40);
+  EXPECT_EQ(nullptr, RuleFile::open(damaged));
+  // The header is 32 bytes, followed by the rules. Rule 0 starts with its pattern section's
+  // offset, and its full DFA's start and stop states are at bytes 96 and 100 of the rule.
+  EXPECT_EQ(nullptr, open_damaged(8, rule_file_version + 1));
+  EXPECT_EQ(nullptr, open_damaged(32 + 6, 1));
+  EXPECT_EQ(nullptr, open_damaged(32 + 96 + 2, 1));
+  EXPECT_EQ(nullptr, open_damaged(32 + 100 + 2, 1));
+  EXPECT_NE(nullptr, open_damaged(0, contents[0]));
+  EXPECT_EQ(nullptr, RuleFile::open(path + "_missing"));
+  EXPECT_FALSE(write_rule_file(path, {"a(b"}));
+}
+
+TEST(UreTest, TestBitNfa) {
+  UreBitNfa ure("a(bb)+a");
+  ASSERT_FALSE(ure.parsing_failed());
+  ASSERT_FALSE(ure.compile_failed());
+  ASSERT_TRUE(ure.full_match("abbbba"));
+  ASSERT_FALSE(ure.full_match("abbba"));
+  ASSERT_FALSE(ure.full_match("zzzabbbbazzz"));
+  ASSERT_TRUE(ure.partial_match("zzzabbbbazzz"));
+  ASSERT_FALSE(ure.partial_match("zzzabbbazzz"));
+
+  UreBitNfa bad("a(b");
+  ASSERT_TRUE(bad.parsing_failed());
+  ASSERT_FALSE(bad.compile_failed());
+  ASSERT_EQ(1, bad.parser_error_info().idx);
+
+  string fits(64, 'a');
+  EXPECT_FALSE(UreBitNfa(fits).compile_failed());
+  EXPECT_TRUE(UreBitNfa(fits).full_match(fits));
+  EXPECT_TRUE(UreBitNfa(fits).partial_match("b" + fits + "b"));
+  UreBitNfa too_large(fits + "a");
+  ASSERT_FALSE(too_large.parsing_failed());
+  ASSERT_TRUE(too_large.compile_failed());
+  EXPECT_FALSE(too_large.full_match(fits + "a"));
+
+  ASSERT_TRUE(UreBitNfa("abc").partial_match("\nabc\n"));
+  test_class<UreStl, UreBitNfa>(".");
+  test_class<UreStl, UreBitNfa>("\\d");
+  test_class<UreStl, UreBitNfa>("\\D");
+  test_class<UreStl, UreBitNfa>("\\s");
+  test_class<UreStl, UreBitNfa>("\\S");
+  test_class<UreStl, UreBitNfa>("\\w");
+  test_class<UreStl, UreBitNfa>("\\W");
+  test_class<UreStl, UreBitNfa>("[a-zA-Z]");
+  test_class<UreStl, UreBitNfa>("[^a A-Z$0-9]");
+  test_class<UreStl, UreBitNfa>("[]");
+  test_class<UreStl, UreBitNfa>("[^]");
+
+  test_all_regexes<UreStl, UreBitNfa>("abc.+*?()|\\", 4, "abcd", 4);
+}
+
+TEST(UreTest, TestSet) {
+  vector<string> patterns = {"a(bb)+a", "ab", "b*", "c|d", "[ab]c.", "(a|b)*c", "[cd]+a", "[^a]d"};
+  UreSet set(patterns);
+  ASSERT_FALSE(set.parsing_failed());
+  EXPECT_EQ(vector<size_t>({0, 1, 2}), set.partial_match("zzzabbbbazzz"));
+  EXPECT_EQ(vector<size_t>({0}), set.full_match("abbbba"));
+  EXPECT_EQ(vector<size_t>({2}), set.full_match(""));
+  EXPECT_EQ(vector<size_t>(), set.full_match("zzz"));
+
+  UreSet bad({"ab", "a(b", "c"});
+  ASSERT_TRUE(bad.parsing_failed());
+  EXPECT_EQ(1, bad.failed_pattern());
+  EXPECT_EQ(1, bad.parser_error_info().idx);
+  EXPECT_EQ(vector<size_t>(), bad.partial_match("ab"));
+
+  EXPECT_EQ(vector<size_t>(), UreSet({}).partial_match("abc"));
+
+  // Compare against matching each pattern separately, for every text up to length 5.
+  vector<UreStl> references;
+  for (const string& pattern : patterns) {
+    references.emplace_back(pattern);
+  }
+  string chars = "abcd";
+  for (int length = 0; length <= 5; length++) {
+    string text(length, ' ');
+    int num_texts = pow(chars.size(), length);
+    for (int text_idx = 0; text_idx < num_texts; text_idx++) {
+      for (int i = 0; i < length; i++) {
+        text[length - i - 1] = chars[(text_idx / pow(chars.size(), i)) % chars.size()];
+      }
+      vector<size_t> expected_full, expected_partial;
+      for (size_t i = 0; i < patterns.size(); i++) {
+        if (references[i].full_match(text)) expected_full.push_back(i);
+        if (references[i].partial_match(text)) expected_partial.push_back(i);
+      }
+      EXPECT_EQ(expected_full, set.full_match(text)) << "Text: \"" << text << "\"";
+      EXPECT_EQ(expected_partial, set.partial_match(text)) << "Text: \"" << text << "\"";
+    }
+  }
+}
+
+TEST(UreTest, TestLiteralSet) {
+  vector<string> literals = {"he", "she", "his", "hers", "", "e", "she"};
+  AhoCorasick ac(literals);
+  vector<SetMatch> expected = {
+    {4, 0, 0}, {4, 1, 1}, {4, 2, 2}, {4, 3, 3}, {1, 1, 4}, {6, 1, 4}, {0, 2, 4}, {5, 3, 4}, {4, 4, 4},
+    {4, 5, 5}, {3, 2, 6}, {4, 6, 6},
+  };
+  EXPECT_EQ(expected, ac.find_all("ushers"));
+  EXPECT_EQ(vector<size_t>({1, 6}), ac.full_match("she"));
+  EXPECT_EQ(vector<size_t>({4}), ac.full_match(""));
+  EXPECT_EQ(vector<size_t>(), ac.full_match("sh"));
+
+  // Compare UreSet (which detects the patterns are all literals) against matching each
+  // pattern separately, for every text up to length 6.
+  vector<string> patterns = {"ab", "b", "abc", "bca", "cc", "dab", "ab", "\\.a"};
+  UreSet set(patterns);
+  ASSERT_FALSE(set.parsing_failed());
+  vector<UreStl> references;
+  for (const string& pattern : patterns) {
+    references.emplace_back(pattern);
+  }
+  string chars = "abcd.";
+  for (int length = 0; length <= 6; length++) {
+    string text(length, ' ');
+    int num_texts = pow(chars.size(), length);
+    for (int text_idx = 0; text_idx < num_texts; text_idx++) {
+      for (int i = 0; i < length; i++) {
+        text[length - i - 1] = chars[(text_idx / pow(chars.size(), i)) % chars.size()];
+      }
+      vector<size_t> expected_full, expected_partial;
+      for (size_t i = 0; i < patterns.size(); i++) {
+        if (references[i].full_match(text)) expected_full.push_back(i);
+        if (references[i].partial_match(text)) expected_partial.push_back(i);
+      }
+      EXPECT_EQ(expected_full, set.full_match(text)) << "Text: \"" << text << "\"";
+      EXPECT_EQ(expected_partial, set.partial_match(text)) << "Text: \"" << text << "\"";
+    }
+  }
+}